@@ -0,0 +1,668 @@
+// Headless benchmark for the slideshow's hot paths: scanning the source
+// tree, decoding, downscaling, converting to the display format, uploading
+// a frame and a full changeFile() tick. It runs on the offscreen platform and prints one JSON document, so
+// results of two builds can be diffed or compared by a script. Downscaling
+// and conversion results are also checked against a reference; the exit
+// code is 2 if one is off by more than its tolerance.
+
+#include <QApplication>
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QPixmap>
+#include <QSettings>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QtMath>
+
+#include <algorithm>
+
+#include "downscaler.h"
+#include "fileindex.h"
+#include "headerprober.h"
+#include "imageloader.h"
+#include "imageviewer.h"
+#include "indexscanner.h"
+#include "mappedfile.h"
+
+namespace {
+
+struct Options {
+    QString corpus;
+    int images;
+    int scanFiles;
+    int repeat;
+    int ticks;
+    int tickGapMs;
+    int viewWidth;
+};
+
+// Deterministic, so every build sees the same corpus.
+class Lcg
+{
+public:
+    explicit Lcg(quint32 seed) : state(seed) {}
+    int next(int bound)
+    {
+        state = state * 1664525u + 1013904223u;
+        return int((state >> 8) % quint32(bound));
+    }
+
+private:
+    quint32 state;
+};
+
+QJsonObject summarize(const QString &name, QVector<double> samples)
+{
+    QJsonObject result;
+    result.insert("name", name);
+    result.insert("unit", "ms");
+    result.insert("samples", samples.size());
+    if (samples.isEmpty())
+        return result;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    foreach (double sample, samples)
+        sum += sample;
+    // Nearest rank.
+    auto percentile = [&samples](double p) {
+        const int rank = qMax(1, qCeil(p / 100.0 * samples.size()));
+        return samples.at(qMin(rank, samples.size()) - 1);
+    };
+    result.insert("mean", sum / samples.size());
+    result.insert("min", samples.first());
+    result.insert("p50", percentile(50));
+    result.insert("p90", percentile(90));
+    result.insert("p99", percentile(99));
+    result.insert("max", samples.last());
+    return result;
+}
+
+double msSince(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+// Something JPEG has to work for: a gradient under random shapes.
+QImage syntheticImage(const QSize &size, Lcg *rng)
+{
+    QImage image(size, QImage::Format_RGB32);
+    QPainter painter(&image);
+    QLinearGradient gradient(0, 0, size.width(), size.height());
+    gradient.setColorAt(0, QColor::fromHsv(rng->next(360), 200, 220));
+    gradient.setColorAt(1, QColor::fromHsv(rng->next(360), 180, 60));
+    painter.fillRect(image.rect(), gradient);
+    painter.setPen(Qt::NoPen);
+    const int shapes = 200;
+    for (int i = 0; i < shapes; ++i) {
+        painter.setBrush(QColor::fromHsv(rng->next(360), rng->next(256), rng->next(256), 160));
+        const int w = 1 + rng->next(qMax(1, size.width() / 4));
+        const int h = 1 + rng->next(qMax(1, size.height() / 4));
+        painter.drawEllipse(rng->next(size.width()), rng->next(size.height()), w, h);
+    }
+    return image;
+}
+
+bool writeBytes(const QString &fileName, const QByteArray &bytes)
+{
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly) && file.write(bytes) == bytes.size();
+}
+
+// photos/ holds real images of varied sizes, landscape and portrait.
+// deep/ is a long chain of directories and wide/ many siblings, both
+// filled with copies of one small JPEG since scanning never opens them.
+bool generateCorpus(const QString &root, const Options &options, QStringList *photos)
+{
+    static const QSize sizes[] = {
+        QSize(640, 480), QSize(1600, 1200), QSize(2048, 1365),
+        QSize(3000, 2000), QSize(4000, 3000)
+    };
+    const int sizeCount = int(sizeof(sizes) / sizeof(sizes[0]));
+    Lcg rng(12345);
+    QDir dir(root);
+    for (int i = 0; i < options.images; ++i) {
+        const QString sub = QString("photos/set%1").arg(i % 8);
+        if (!dir.mkpath(sub))
+            return false;
+        QSize size = sizes[i % sizeCount];
+        if (i % 3 == 2)
+            size.transpose();
+        const QString fileName = root + QString("/%1/img%2.jpg").arg(sub).arg(i, 5, 10, QLatin1Char('0'));
+        QImageWriter writer(fileName, "jpeg");
+        writer.setQuality(85);
+        if (!writer.write(syntheticImage(size, &rng))) {
+            qWarning() << "Cannot write" << fileName << writer.errorString();
+            return false;
+        }
+        photos->append(fileName);
+    }
+
+    QByteArray tiny;
+    {
+        QBuffer buffer(&tiny);
+        buffer.open(QIODevice::WriteOnly);
+        syntheticImage(QSize(64, 48), &rng).save(&buffer, "jpeg");
+    }
+    const int depth = 40;
+    const int wideDirs = 400;
+    const int deepFiles = options.scanFiles / 4;
+    const int wideFiles = options.scanFiles - deepFiles;
+    QString path = "deep";
+    for (int level = 0; level < depth; ++level) {
+        path += QString("/d%1").arg(level);
+        if (!dir.mkpath(path))
+            return false;
+        const int count = deepFiles / depth + (level < deepFiles % depth ? 1 : 0);
+        for (int i = 0; i < count; ++i) {
+            if (!writeBytes(root + QString("/%1/f%2.jpg").arg(path).arg(i), tiny))
+                return false;
+        }
+    }
+    for (int d = 0; d < wideDirs; ++d) {
+        const QString sub = QString("wide/w%1").arg(d, 4, 10, QLatin1Char('0'));
+        if (!dir.mkpath(sub))
+            return false;
+        const int count = wideFiles / wideDirs + (d < wideFiles % wideDirs ? 1 : 0);
+        for (int i = 0; i < count; ++i) {
+            if (!writeBytes(root + QString("/%1/f%2.jpg").arg(sub).arg(i), tiny))
+                return false;
+        }
+    }
+    return true;
+}
+
+QJsonArray benchScan(const QString &root, const Options &options, int *fileCount)
+{
+    const QString pattern = QStringLiteral("*.jpg");
+    QVector<double> sequentialFull, sequentialRevalidate, parallelFull, parallelRevalidate;
+    FileIndex index;
+    for (int r = 0; r < options.repeat; ++r) {
+        QElapsedTimer timer;
+        timer.start();
+        index = FileIndex::scan(root, pattern);
+        sequentialFull.append(msSince(timer));
+        timer.start();
+        FileIndex::scan(root, pattern, index);
+        sequentialRevalidate.append(msSince(timer));
+    }
+    *fileCount = index.fileCount();
+
+    IndexScanner scanner;
+    QEventLoop loop;
+    QObject::connect(&scanner, &IndexScanner::finished, &loop, &QEventLoop::quit);
+    for (int r = 0; r < options.repeat; ++r) {
+        QElapsedTimer timer;
+        timer.start();
+        scanner.start(root, pattern, FileIndex());
+        loop.exec();
+        parallelFull.append(msSince(timer));
+        const FileIndex previous = scanner.result();
+        timer.start();
+        scanner.start(root, pattern, previous);
+        loop.exec();
+        parallelRevalidate.append(msSince(timer));
+    }
+
+    QJsonArray results;
+    const QVector<double> *runs[] = {
+        &sequentialFull, &sequentialRevalidate, &parallelFull, &parallelRevalidate
+    };
+    const char *names[] = {
+        "scan.sequential.full", "scan.sequential.revalidate",
+        "scan.parallel.full", "scan.parallel.revalidate"
+    };
+    for (int i = 0; i < 4; ++i) {
+        QJsonObject result = summarize(names[i], *runs[i]);
+        QVector<double> sorted = *runs[i];
+        std::sort(sorted.begin(), sorted.end());
+        result.insert("filesPerSecond", qRound64(*fileCount * 1000.0 / qMax(0.001, sorted.at(sorted.size() / 2))));
+        results.append(result);
+    }
+    return results;
+}
+
+QJsonArray benchDecode(const QStringList &photos, const Options &options)
+{
+    QVector<double> probe, full, scaled, upload;
+    const QSize target(options.viewWidth, 0);
+    for (int r = 0; r < options.repeat; ++r) {
+        foreach (const QString &fileName, photos) {
+            QElapsedTimer timer;
+            timer.start();
+            const FileIndex::Meta meta = HeaderProber::probe(fileName);
+            probe.append(msSince(timer));
+            if (meta.state != FileIndex::Readable)
+                qWarning() << "Cannot probe" << fileName;
+
+            timer.start();
+            QImageReader reader(fileName);
+            reader.setAutoTransform(true);
+            const QImage image = reader.read();
+            full.append(msSince(timer));
+            if (image.isNull())
+                qWarning() << "Cannot decode" << fileName << reader.errorString();
+
+            timer.start();
+            const ImageLoader::Frame frame = ImageLoader::decode(fileName, target);
+            scaled.append(msSince(timer));
+
+            timer.start();
+            const QPixmap pixmap = QPixmap::fromImage(frame.image);
+            upload.append(msSince(timer));
+            Q_UNUSED(pixmap);
+        }
+    }
+    QJsonArray results;
+    results.append(summarize("probe.header", probe));
+    results.append(summarize("decode.full", full));
+    results.append(summarize("decode.scaled", scaled));
+    results.append(summarize("upload.fromImage", upload));
+    return results;
+}
+
+// Tolerances of the correctness checks, in levels of an 8-bit channel.
+// The box and bilinear passes of the Downscaler only approximate an exact
+// area average of the same source area: on the synthetic images they stay
+// within 0.6 on average, while a result shifted by one pixel is 1.5 off
+// and swapped channels 20. The bilinear pass still softens hard shape
+// edges differently, so the few channels there are left out by bounding
+// the 99th percentile rather than the maximum.
+const double downscaleMeanTolerance = 1.0;
+const int downscalePercentileTolerance = 16;
+// Conversions are exact; one level allows for Qt rounding differently.
+const int convertMaxTolerance = 1;
+
+struct ChannelDiff {
+    double mean;
+    int max;        // -1 if the sizes differ
+    int p99;        // 99th percentile
+};
+
+ChannelDiff channelDiff(const QImage &a, const QImage &b)
+{
+    ChannelDiff diff = { 0, -1, -1 };
+    if (a.size() != b.size() || a.isNull())
+        return diff;
+    const QImage x = a.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QImage y = b.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    qint64 counts[256] = {};
+    for (int row = 0; row < x.height(); ++row) {
+        const uchar *p = x.constScanLine(row);
+        const uchar *q = y.constScanLine(row);
+        for (int i = 0; i < x.width() * 4; ++i)
+            ++counts[qAbs(int(p[i]) - int(q[i]))];
+    }
+    const qint64 total = qint64(x.width()) * x.height() * 4;
+    qint64 sum = 0;
+    qint64 seen = 0;
+    for (int d = 0; d < 256; ++d) {
+        if (!counts[d])
+            continue;
+        sum += d * counts[d];
+        seen += counts[d];
+        diff.max = d;
+        if (diff.p99 < 0 && seen * 100 >= total * 99)
+            diff.p99 = d;
+    }
+    diff.mean = double(sum) / total;
+    return diff;
+}
+
+// The source area the Downscaler covers when scaling from sourceSize to
+// size: its box pass drops the rows and columns that do not fill a whole
+// block, split between the two edges.
+QRect downscaledArea(const QSize &sourceSize, const QSize &size)
+{
+    const int fx = qMax(1, sourceSize.width() / size.width());
+    const int fy = qMax(1, sourceSize.height() / size.height());
+    const int width = sourceSize.width() / fx * fx;
+    const int height = sourceSize.height() / fy * fy;
+    return QRect((sourceSize.width() - width) / 2, (sourceSize.height() - height) / 2,
+                 width, height);
+}
+
+// Reference for the Downscaler, written for clarity rather than speed and
+// sharing none of its code: every target pixel is the average of the part
+// of area it covers, partly covered pixels weighted by their share.
+QImage areaAverage(const QImage &image, const QRect &area, const QSize &size)
+{
+    const QImage src = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage dst(size, QImage::Format_ARGB32_Premultiplied);
+    const double sx = double(area.width()) / size.width();
+    const double sy = double(area.height()) / size.height();
+    for (int y = 0; y < size.height(); ++y) {
+        const double top = area.top() + y * sy;
+        const double bottom = area.top() + (y + 1) * sy;
+        QRgb *out = reinterpret_cast<QRgb *>(dst.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const double left = area.left() + x * sx;
+            const double right = area.left() + (x + 1) * sx;
+            double sum[4] = { 0, 0, 0, 0 };
+            double total = 0;
+            for (int j = int(top); j < qMin(qCeil(bottom), src.height()); ++j) {
+                const double wy = qMin(bottom, j + 1.0) - qMax(top, double(j));
+                const QRgb *in = reinterpret_cast<const QRgb *>(src.constScanLine(j));
+                for (int i = int(left); i < qMin(qCeil(right), src.width()); ++i) {
+                    const double w = wy * (qMin(right, i + 1.0) - qMax(left, double(i)));
+                    sum[0] += w * qRed(in[i]);
+                    sum[1] += w * qGreen(in[i]);
+                    sum[2] += w * qBlue(in[i]);
+                    sum[3] += w * qAlpha(in[i]);
+                    total += w;
+                }
+            }
+            out[x] = qRgba(qRound(sum[0] / total), qRound(sum[1] / total),
+                           qRound(sum[2] / total), qRound(sum[3] / total));
+        }
+    }
+    return dst;
+}
+
+// Records a failed check on stderr and in failures.
+void check(bool ok, const QString &what, QStringList *failures)
+{
+    if (ok)
+        return;
+    qWarning("Check failed: %s", qPrintable(what));
+    failures->append(what);
+}
+
+// Reduction to a small window, by Qt's smooth scaling and by every
+// Downscaler path this CPU has, single threaded and banded. Each path is
+// checked against areaAverage().
+QJsonArray benchDownscale(const Options &options, QStringList *failures)
+{
+    static const QSize sources[] = { QSize(4000, 3000), QSize(1600, 1200) };
+    const int iterations = options.repeat * 4;
+    Lcg rng(777);
+    QJsonArray results;
+    for (const QSize &sourceSize : sources) {
+        const QImage source = syntheticImage(sourceSize, &rng);
+        const QSize target(640, 640 * sourceSize.height() / sourceSize.width());
+        const QString suffix = QString(".%1x%2").arg(sourceSize.width()).arg(sourceSize.height());
+
+        QVector<double> qt;
+        for (int i = 0; i < iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            const QImage scaled = source.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            qt.append(msSince(timer));
+            Q_UNUSED(scaled);
+        }
+        results.append(summarize("downscale.qt" + suffix, qt));
+
+        const QImage reference = areaAverage(source, downscaledArea(sourceSize, target), target);
+        for (int path = Downscaler::Scalar; path <= Downscaler::bestPath(); ++path) {
+            for (int threads = 1; threads >= 0; --threads) {
+                QVector<double> samples;
+                QImage scaled;
+                for (int i = 0; i < iterations; ++i) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    scaled = Downscaler::scale(source, target, Downscaler::Path(path), threads);
+                    samples.append(msSince(timer));
+                }
+                const QString name = QString("downscale.%1%2%3")
+                    .arg(Downscaler::pathName(Downscaler::Path(path)))
+                    .arg(threads == 1 ? "" : ".banded").arg(suffix);
+                QJsonObject result = summarize(name, samples);
+                const ChannelDiff diff = channelDiff(scaled, reference);
+                result.insert("meanDiffVsReference", diff.mean);
+                result.insert("maxDiffVsReference", diff.max);
+                result.insert("p99DiffVsReference", diff.p99);
+                check(diff.max >= 0 && diff.mean <= downscaleMeanTolerance
+                      && diff.p99 <= downscalePercentileTolerance,
+                      QString("%1 differs from the area average by %2 on average, %3 at the 99th percentile")
+                      .arg(name).arg(diff.mean, 0, 'f', 2).arg(diff.p99), failures);
+                results.append(result);
+            }
+        }
+    }
+    return results;
+}
+
+// Conversion of each decoder output format to the display format, by Qt
+// and by every Downscaler path this CPU has, single threaded. Each path is
+// checked against Qt.
+QJsonArray benchConvert(const Options &options, QStringList *failures)
+{
+    struct Format {
+        QImage::Format format;
+        const char *name;
+    };
+    static const Format formats[] = {
+        { QImage::Format_Grayscale8, "grayscale8" },
+        { QImage::Format_Indexed8, "indexed8" },
+        { QImage::Format_RGB888, "rgb888" },
+        { QImage::Format_ARGB32, "argb32" },
+        { QImage::Format_RGB16, "rgb16" },
+    };
+    const int iterations = options.repeat * 2;
+    Lcg rng(4242);
+    const QImage base = syntheticImage(QSize(3000, 2000), &rng);
+    QJsonArray results;
+    for (const Format &format : formats) {
+        const QImage source = base.convertToFormat(format.format);
+        const QImage::Format target = source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                               : QImage::Format_RGB32;
+        QVector<double> qt;
+        QImage reference;
+        for (int i = 0; i < iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            reference = source.convertToFormat(target);
+            qt.append(msSince(timer));
+        }
+        results.append(summarize(QString("convert.%1.qt").arg(format.name), qt));
+
+        for (int path = Downscaler::Scalar; path <= Downscaler::bestPath(); ++path) {
+            QVector<double> samples;
+            QImage converted;
+            for (int i = 0; i < iterations; ++i) {
+                QElapsedTimer timer;
+                timer.start();
+                converted = Downscaler::toDisplayFormat(source, Downscaler::Path(path), 1);
+                samples.append(msSince(timer));
+            }
+            const QString name = QString("convert.%1.%2").arg(format.name)
+                .arg(Downscaler::pathName(Downscaler::Path(path)));
+            QJsonObject result = summarize(name, samples);
+            const ChannelDiff diff = channelDiff(converted, reference);
+            result.insert("maxDiffVsQt", diff.max);
+            check(diff.max >= 0 && diff.max <= convertMaxTolerance,
+                  QString("%1 differs from Qt by %2").arg(name).arg(diff.max), failures);
+            results.append(result);
+        }
+    }
+    return results;
+}
+
+void processEventsFor(int ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+        QThread::msleep(1);
+    }
+}
+
+// Drives the real viewer: its settings point it at the photos, its own
+// timer is pushed out of the way and changeFile() is called directly.
+QJsonObject benchTicks(const QString &root, const Options &options)
+{
+    const QString photos = root + QStringLiteral("/photos");
+    FileIndex index = FileIndex::scan(photos, QStringLiteral("*.jpg"));
+    index.save(FileIndex::defaultLocation());
+    {
+        QSettings settings(QCoreApplication::organizationName(), QCoreApplication::applicationName());
+        settings.clear();
+        settings.setValue("sourcepath", photos);
+        settings.setValue("delay", 3600 * 1000);
+        settings.setValue("size", QSize(options.viewWidth, options.viewWidth * 2 / 3));
+    }
+
+    ImageViewer viewer;
+    viewer.show();
+    processEventsFor(500);
+
+    QVector<double> ticks;
+    int misses = 0;
+    for (int i = 0; i < options.ticks; ++i) {
+        processEventsFor(options.tickGapMs);
+        const QString before = viewer.windowFilePath();
+        QElapsedTimer timer;
+        timer.start();
+        QMetaObject::invokeMethod(&viewer, "changeFile", Qt::DirectConnection);
+        ticks.append(msSince(timer));
+        // A pick that was not decoded yet leaves the old frame up.
+        if (viewer.windowFilePath() == before)
+            misses++;
+    }
+    QJsonObject result = summarize("tick.changeFile", ticks);
+    result.insert("misses", misses);
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    // Keep the viewer's settings and saved index apart from a real install.
+    QCoreApplication::setOrganizationName("FDev");
+    QCoreApplication::setApplicationName("ImageViewerBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks scanning, decoding and slideshow ticks.");
+    parser.addHelpOption();
+    QCommandLineOption corpusOption("corpus", "Reuse or create the corpus in <dir>.", "dir");
+    QCommandLineOption imagesOption("images", "Number of full-size images.", "n", "40");
+    QCommandLineOption scanFilesOption("scan-files", "Number of small files for the scan tree.", "n", "20000");
+    QCommandLineOption repeatOption("repeat", "Repetitions of the scan and decode runs.", "n", "5");
+    QCommandLineOption ticksOption("ticks", "Slideshow ticks to time.", "n", "100");
+    QCommandLineOption tickGapOption("tick-gap", "Milliseconds between ticks.", "ms", "150");
+    QCommandLineOption widthOption("width", "Width of the viewer window.", "px", "1280");
+    QCommandLineOption outputOption("output", "Write the JSON report to <file>.", "file");
+    parser.addOption(corpusOption);
+    parser.addOption(imagesOption);
+    parser.addOption(scanFilesOption);
+    parser.addOption(repeatOption);
+    parser.addOption(ticksOption);
+    parser.addOption(tickGapOption);
+    parser.addOption(widthOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    Options options;
+    options.corpus = parser.value(corpusOption);
+    options.images = qMax(1, parser.value(imagesOption).toInt());
+    options.scanFiles = qMax(0, parser.value(scanFilesOption).toInt());
+    options.repeat = qMax(1, parser.value(repeatOption).toInt());
+    options.ticks = qMax(1, parser.value(ticksOption).toInt());
+    options.tickGapMs = qMax(0, parser.value(tickGapOption).toInt());
+    options.viewWidth = qMax(64, parser.value(widthOption).toInt());
+
+    QTemporaryDir temporary;
+    QString root = options.corpus;
+    if (root.isEmpty()) {
+        if (!temporary.isValid()) {
+            qWarning() << "Cannot create a temporary directory";
+            return 1;
+        }
+        root = temporary.path();
+    }
+    root = QDir(root).absolutePath();
+
+    QStringList photos;
+    const bool reuse = QDir(root + QStringLiteral("/photos")).exists();
+    QElapsedTimer timer;
+    timer.start();
+    if (reuse) {
+        const FileIndex existing = FileIndex::scan(root + QStringLiteral("/photos"), QStringLiteral("*.jpg"));
+        for (quint32 id = 0; id < existing.idCount(); ++id)
+            photos.append(existing.filePath(id));
+    } else if (!generateCorpus(root, options, &photos)) {
+        qWarning() << "Cannot generate the corpus in" << root;
+        return 1;
+    }
+    const qint64 corpusMs = timer.elapsed();
+
+    QJsonArray results;
+    int scannedFiles = 0;
+    foreach (const QJsonValue &value, benchScan(root, options, &scannedFiles))
+        results.append(value);
+    const MappedFile::Stats readsBefore = MappedFile::stats();
+    foreach (const QJsonValue &value, benchDecode(photos, options))
+        results.append(value);
+    const MappedFile::Stats readsAfter = MappedFile::stats();
+    QStringList failures;
+    foreach (const QJsonValue &value, benchDownscale(options, &failures))
+        results.append(value);
+    foreach (const QJsonValue &value, benchConvert(options, &failures))
+        results.append(value);
+    results.append(benchTicks(root, options));
+
+    QJsonObject corpus;
+    corpus.insert("root", root);
+    corpus.insert("reused", reuse);
+    corpus.insert("generateMs", corpusMs);
+    corpus.insert("images", photos.size());
+    corpus.insert("scannedFiles", scannedFiles);
+
+    // Bytes behind the decode.scaled runs; copied bytes are the ones that
+    // had to be read because the file could not be mapped.
+    QJsonObject reads;
+    const qint64 readFiles = readsAfter.files - readsBefore.files;
+    reads.insert("files", readFiles);
+    reads.insert("mappedBytes", readsAfter.mappedBytes - readsBefore.mappedBytes);
+    reads.insert("copiedBytes", readsAfter.copiedBytes - readsBefore.copiedBytes);
+    reads.insert("copiedBytesPerImage", readFiles ? (readsAfter.copiedBytes - readsBefore.copiedBytes) / readFiles : 0);
+
+    QJsonObject build;
+    build.insert("qt", QString(qVersion()));
+    build.insert("abi", QSysInfo::buildAbi());
+    build.insert("cpu", QSysInfo::currentCpuArchitecture());
+    build.insert("idealThreads", QThread::idealThreadCount());
+    build.insert("downscalerPath", Downscaler::pathName(Downscaler::bestPath()));
+#ifdef QT_DEBUG
+    build.insert("debug", true);
+#else
+    build.insert("debug", false);
+#endif
+
+    QJsonObject report;
+    report.insert("build", build);
+    report.insert("corpus", corpus);
+    report.insert("reads", reads);
+    report.insert("results", results);
+    report.insert("failures", QJsonArray::fromStringList(failures));
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            qWarning() << "Cannot write" << file.fileName();
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    // The report is still written, so a failure can be looked into.
+    return failures.isEmpty() ? 0 : 2;
+}
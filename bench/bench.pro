@@ -0,0 +1,53 @@
+# Headless benchmark, built from the application's own sources.
+# Run with --help for options; it prints a JSON report.
+QT += widgets core
+qtHaveModule(printsupport): QT += printsupport
+!CONFIG(notrace): DEFINES += IMAGEVIEWER_TRACE
+
+TARGET = imageviewer-bench
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+HEADERS       = ../imageviewer.h \
+                ../dirwatcher.h \
+                ../displaymirror.h \
+                ../displayscheduler.h \
+                ../downscaler.h \
+                ../exifthumbnail.h \
+                ../fileindex.h \
+                ../headerprober.h \
+                ../historyring.h \
+                ../imageexporter.h \
+                ../imageloader.h \
+                ../imageview.h \
+                ../indexscanner.h \
+                ../mappedfile.h \
+                ../shufflebag.h \
+                ../skimloader.h \
+                ../thumbnailcache.h \
+                ../thumbnailgrid.h \
+                ../tilepyramid.h \
+                ../trace.h
+SOURCES       = bench.cpp \
+                ../imageviewer.cpp \
+                ../dirwatcher.cpp \
+                ../displaymirror.cpp \
+                ../displayscheduler.cpp \
+                ../downscaler.cpp \
+                ../exifthumbnail.cpp \
+                ../fileindex.cpp \
+                ../headerprober.cpp \
+                ../historyring.cpp \
+                ../imageexporter.cpp \
+                ../imageloader.cpp \
+                ../imageview.cpp \
+                ../indexscanner.cpp \
+                ../mappedfile.cpp \
+                ../shufflebag.cpp \
+                ../skimloader.cpp \
+                ../thumbnailcache.cpp \
+                ../thumbnailgrid.cpp \
+                ../tilepyramid.cpp \
+                ../trace.cpp
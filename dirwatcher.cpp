@@ -0,0 +1,149 @@
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <QDebug>
+
+#include "dirwatcher.h"
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static const quint32 watchMask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+#endif
+
+DirWatcher::DirWatcher(QObject *parent)
+    : QObject(parent)
+    , fd(-1)
+    , notifier(nullptr)
+    , fsWatcher(nullptr)
+    , failed(0)
+{
+#ifdef Q_OS_LINUX
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0) {
+        notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(notifier, SIGNAL(activated(int)), this, SLOT(readEvents()));
+        return;
+    }
+    qDebug() << "inotify unavailable, using QFileSystemWatcher";
+#endif
+    fsWatcher = new QFileSystemWatcher(this);
+    connect(fsWatcher, &QFileSystemWatcher::directoryChanged, this, &DirWatcher::dirChanged);
+}
+
+DirWatcher::~DirWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (fd >= 0) {
+        delete notifier;
+        close(fd);
+    }
+#endif
+}
+
+void DirWatcher::watch(const QStringList &dirs)
+{
+    if (fsWatcher) {
+        if (dirs.isEmpty())
+            return;
+        failed += fsWatcher->addPaths(dirs).size();
+        return;
+    }
+#ifdef Q_OS_LINUX
+    bool limitReported = false;
+    foreach (const QString &dir, dirs) {
+        const int wd = inotify_add_watch(fd, QFile::encodeName(dir).constData(), watchMask);
+        if (wd < 0) {
+            if (errno == ENOSPC && !limitReported) {
+                qDebug() << "inotify watch limit reached at" << watches.size() << "directories";
+                limitReported = true;
+            }
+            failed++;
+            continue;
+        }
+        watches.insert(wd, dir);
+    }
+#endif
+}
+
+void DirWatcher::unwatchAll()
+{
+    failed = 0;
+    if (fsWatcher) {
+        const QStringList dirs = fsWatcher->directories();
+        if (!dirs.isEmpty())
+            fsWatcher->removePaths(dirs);
+        return;
+    }
+#ifdef Q_OS_LINUX
+    for (QHash<int, QString>::const_iterator it = watches.constBegin(); it != watches.constEnd(); ++it)
+        inotify_rm_watch(fd, it.key());
+    watches.clear();
+#endif
+}
+
+int DirWatcher::watchedCount() const
+{
+    return fsWatcher ? fsWatcher->directories().size() : watches.size();
+}
+
+void DirWatcher::unwatchBelow(const QString &path)
+{
+#ifdef Q_OS_LINUX
+    const QString prefix = path + QLatin1Char('/');
+    for (QHash<int, QString>::iterator it = watches.begin(); it != watches.end(); ) {
+        if (it.value() == path || it.value().startsWith(prefix)) {
+            inotify_rm_watch(fd, it.key());
+            it = watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+#else
+    Q_UNUSED(path);
+#endif
+}
+
+void DirWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    for (;;) {
+        const ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+        for (const char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                emit overflow();
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.remove(event->wd);
+                continue;
+            }
+            const QString dir = watches.value(event->wd);
+            if (dir.isEmpty() || event->len == 0)
+                continue;
+            const QString path = dir + QLatin1Char('/') + QFile::decodeName(event->name);
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    emit dirAdded(path);
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    unwatchBelow(path);
+                    emit dirRemoved(path);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                emit fileAdded(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                emit fileRemoved(path);
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,54 @@
+#ifndef DIRWATCHER_H
+#define DIRWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+class QFileSystemWatcher;
+class QSocketNotifier;
+QT_END_NAMESPACE
+
+// Watches a set of directories for changes. On Linux it reads inotify
+// events and reports individual files and directories; elsewhere it falls
+// back to QFileSystemWatcher, which only reports that a directory changed.
+class DirWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DirWatcher(QObject *parent = nullptr);
+    ~DirWatcher();
+
+    // Directories that cannot be watched, e.g. because the inotify watch
+    // limit (fs.inotify.max_user_watches) is reached, are only counted.
+    void watch(const QStringList &dirs);
+    void unwatchAll();
+    int watchedCount() const;
+    int unwatchedCount() const { return failed; }
+
+signals:
+    void fileAdded(const QString &path);
+    void fileRemoved(const QString &path);
+    void dirAdded(const QString &path);
+    void dirRemoved(const QString &path);
+    // Something changed in path; the caller has to compare listings.
+    void dirChanged(const QString &path);
+    // Events were lost; the caller has to revalidate everything.
+    void overflow();
+
+private slots:
+    void readEvents();
+
+private:
+    void unwatchBelow(const QString &path);
+
+    int fd;
+    QSocketNotifier *notifier;
+    QFileSystemWatcher *fsWatcher;
+    QHash<int, QString> watches;
+    int failed;
+};
+
+#endif
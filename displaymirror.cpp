@@ -0,0 +1,342 @@
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+#include <QThread>
+
+#include "displaymirror.h"
+#include "trace.h"
+
+namespace {
+
+// Text keys the source's size and mtime are kept under, as JPEG comments.
+const char sourceSizeKey[] = "Source-Size";
+const char sourceMTimeKey[] = "Source-MTime";
+const int quality = 85;
+
+QAtomicInteger<qint64> madeCount;
+QAtomicInteger<qint64> freshCount;
+QAtomicInteger<qint64> failedCount;
+QAtomicInteger<qint64> readByteCount;
+QAtomicInteger<qint64> writtenByteCount;
+QAtomicInteger<qint64> hitCount;
+QAtomicInteger<qint64> missCount;
+
+struct MirrorItem {
+    quint32 id;
+    QString fileName; // empty for files of the job's index
+};
+
+struct MirrorHeader {
+    QSize size;
+    QSize sourceSize;
+    qint64 sourceMTime;
+};
+
+// Only the header of the copy is read.
+bool readHeader(const QString &mirror, MirrorHeader *header)
+{
+    if (!QFileInfo::exists(mirror))
+        return false;
+    QImageReader reader(mirror);
+    const QStringList sides = reader.text(QLatin1String(sourceSizeKey)).split(QLatin1Char('x'));
+    bool mtimeOk = false;
+    header->size = reader.size();
+    header->sourceMTime = reader.text(QLatin1String(sourceMTimeKey)).toLongLong(&mtimeOk);
+    header->sourceSize = sides.size() == 2 ? QSize(sides.at(0).toInt(), sides.at(1).toInt()) : QSize();
+    return mtimeOk && header->size.isValid() && header->sourceSize.isValid();
+}
+
+} // namespace
+
+struct MirrorJob
+{
+    MirrorJob(DisplayMirror *mirror, int generation, const FileIndex &index, int width, int readLimit)
+        : mirror(mirror), generation(generation), index(index), width(width)
+        , bytesPerMs(readLimit * 1024.0 * 1024.0 / 1000.0), cancelled(0)
+        , next(0), workers(0), readsUntil(0)
+    {
+        clock.start();
+    }
+
+    // Take the next file to copy, or retire the calling worker.
+    bool take(MirrorItem *item, bool *last)
+    {
+        QMutexLocker locker(&mutex);
+        if (cancelled.load() || next == items.size()) {
+            *last = --workers == 0 && !cancelled.load();
+            return false;
+        }
+        *item = items.at(next++);
+        return true;
+    }
+
+    // Book the read of bytes at the read limit and wait for its turn.
+    void throttle(qint64 bytes)
+    {
+        if (bytesPerMs <= 0)
+            return;
+        qint64 wait;
+        {
+            QMutexLocker locker(&mutex);
+            const qint64 now = clock.elapsed();
+            const qint64 start = qMax(now, readsUntil);
+            readsUntil = start + qint64(bytes / bytesPerMs);
+            wait = start - now;
+        }
+        if (wait > 0)
+            QThread::msleep(wait);
+    }
+
+    DisplayMirror *mirror;
+    const int generation;
+    const FileIndex index;
+    const int width;
+    const double bytesPerMs; // 0 for no limit
+    QAtomicInt cancelled;
+    QElapsedTimer clock;
+
+    QMutex mutex;           // guards everything below
+    QVector<MirrorItem> items;
+    int next;
+    int workers;            // workers that have not exited yet
+    qint64 readsUntil;      // on clock, when the booked reads are done
+};
+
+namespace {
+
+class MirrorWorker : public QRunnable
+{
+public:
+    explicit MirrorWorker(const QSharedPointer<MirrorJob> &job) : m_job(job) {}
+
+    void run() override
+    {
+        MirrorItem item;
+        bool last = false;
+        while (m_job->take(&item, &last))
+            copy(item);
+        if (last)
+            QMetaObject::invokeMethod(m_job->mirror, "onFinished", Qt::QueuedConnection,
+                                      Q_ARG(int, m_job->generation));
+    }
+
+private:
+    void copy(const MirrorItem &item)
+    {
+        TRACE_SPAN("DisplayMirror::copy");
+        QString fileName = item.fileName;
+        qint64 size;
+        qint64 mtime;
+        if (fileName.isEmpty()) {
+            const FileIndex::File file = m_job->index.fileAt(item.id);
+            fileName = m_job->index.filePath(item.id);
+            size = file.size;
+            mtime = file.mtime;
+        } else {
+            const QFileInfo info(fileName);
+            size = info.size();
+            mtime = FileIndex::modificationTime(fileName);
+        }
+        const QString target = DisplayMirror::mirrorPath(m_job->index.root(), fileName);
+        if (target.isEmpty())
+            return;
+        MirrorHeader header;
+        if (readHeader(target, &header) && header.sourceMTime == mtime
+            && header.size.width() >= qMin(m_job->width, header.sourceSize.width())) {
+            freshCount.fetchAndAddRelaxed(1);
+            return;
+        }
+
+        // One read of the whole file, so the decode does not hold the
+        // source open while it works.
+        m_job->throttle(size);
+        if (m_job->cancelled.load())
+            return;
+        QByteArray bytes;
+        {
+            TRACE_SPAN("DisplayMirror::read");
+            QFile file(fileName);
+            if (file.open(QIODevice::ReadOnly))
+                bytes = file.readAll();
+        }
+        readByteCount.fetchAndAddRelaxed(bytes.size());
+        QBuffer buffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+        ImageLoader::Frame frame = ImageLoader::decode(&buffer, QSize(m_job->width, 0));
+        if (frame.image.isNull()) {
+            failedCount.fetchAndAddRelaxed(1);
+            return;
+        }
+        frame.image.setText(QLatin1String(sourceSizeKey), QString("%1x%2")
+                            .arg(frame.sourceSize.width()).arg(frame.sourceSize.height()));
+        frame.image.setText(QLatin1String(sourceMTimeKey), QString::number(mtime));
+
+        TRACE_SPAN("DisplayMirror::write");
+        QDir().mkpath(QFileInfo(target).path());
+        QSaveFile out(target);
+        QImageWriter writer(&out, "jpeg");
+        writer.setQuality(quality);
+        if (!out.open(QIODevice::WriteOnly) || !writer.write(frame.image) || !out.commit()) {
+            failedCount.fetchAndAddRelaxed(1);
+            return;
+        }
+        madeCount.fetchAndAddRelaxed(1);
+        writtenByteCount.fetchAndAddRelaxed(QFileInfo(target).size());
+    }
+
+    QSharedPointer<MirrorJob> m_job;
+};
+
+} // namespace
+
+DisplayMirror::DisplayMirror(QObject *parent)
+    : QObject(parent)
+    , generation(0)
+    , mirrorWidth(1280)
+    , readLimit(0)
+{
+    pool.setMaxThreadCount(2);
+}
+
+DisplayMirror::~DisplayMirror()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void DisplayMirror::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int DisplayMirror::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void DisplayMirror::start(const FileIndex &index, const QVector<quint32> &ids)
+{
+    cancel();
+    generation++;
+    job = QSharedPointer<MirrorJob>(new MirrorJob(this, generation, index, mirrorWidth, readLimit));
+    job->items.reserve(ids.size());
+    foreach (quint32 id, ids)
+        job->items.append(MirrorItem{ id, QString() });
+    job->workers = qMin(pool.maxThreadCount(), ids.size());
+    for (int i = 0; i < job->workers; ++i)
+        pool.start(new MirrorWorker(job));
+}
+
+void DisplayMirror::add(const QString &fileName)
+{
+    // Without a pass there is no root to mirror below.
+    if (!job || job->cancelled.load())
+        return;
+    QMutexLocker locker(&job->mutex);
+    job->items.append(MirrorItem{ 0, fileName });
+    if (job->workers < pool.maxThreadCount()) {
+        job->workers++;
+        pool.start(new MirrorWorker(job));
+    }
+}
+
+void DisplayMirror::cancel()
+{
+    if (job)
+        job->cancelled.store(1);
+}
+
+bool DisplayMirror::isRunning() const
+{
+    if (!job || job->cancelled.load())
+        return false;
+    QMutexLocker locker(&job->mutex);
+    return job->workers > 0;
+}
+
+DisplayMirror::Stats DisplayMirror::stats() const
+{
+    Stats stats;
+    stats.made = int(madeCount.load());
+    stats.fresh = int(freshCount.load());
+    stats.failed = int(failedCount.load());
+    stats.remaining = 0;
+    if (job && !job->cancelled.load()) {
+        QMutexLocker locker(&job->mutex);
+        stats.remaining = job->items.size() - job->next;
+    }
+    stats.bytesRead = readByteCount.load();
+    stats.bytesWritten = writtenByteCount.load();
+    stats.hits = hitCount.load();
+    stats.misses = missCount.load();
+    return stats;
+}
+
+QString DisplayMirror::cacheDir(const QString &root)
+{
+    // One tree per source, named after its path.
+    const QByteArray hash = QCryptographicHash::hash(QDir::cleanPath(root).toUtf8(),
+                                                     QCryptographicHash::Md5).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+        + QStringLiteral("/mirror/") + QString::fromLatin1(hash.left(16));
+}
+
+QString DisplayMirror::mirrorPath(const QString &root, const QString &fileName)
+{
+    const QString relative = QDir(root).relativeFilePath(fileName);
+    if (root.isEmpty() || relative.startsWith(QLatin1String("..")) || QDir::isAbsolutePath(relative))
+        return QString();
+    return cacheDir(root) + QLatin1Char('/') + relative;
+}
+
+bool DisplayMirror::decode(const QString &root, const QString &fileName, const QSize &targetSize,
+                           ImageLoader::Frame *frame)
+{
+    TRACE_SPAN("DisplayMirror::decode");
+    const QString mirror = mirrorPath(root, fileName);
+    MirrorHeader header;
+    if (mirror.isEmpty() || !readHeader(mirror, &header)
+        || header.sourceMTime != FileIndex::modificationTime(fileName)) {
+        missCount.fetchAndAddRelaxed(1);
+        return false;
+    }
+    // The same test as for the frame cache: enough pixels for the target.
+    const QSize needed = ImageLoader::scaledDecodeSize(header.sourceSize, targetSize);
+    const bool enough = needed.isValid()
+        ? header.size.width() >= needed.width()
+        : header.size == header.sourceSize;
+    if (!enough) {
+        missCount.fetchAndAddRelaxed(1);
+        return false;
+    }
+    ImageLoader::Frame copy = ImageLoader::decode(mirror, targetSize);
+    if (copy.image.isNull()) {
+        missCount.fetchAndAddRelaxed(1);
+        return false;
+    }
+    copy.sourceSize = header.sourceSize;
+    copy.mtime = header.sourceMTime;
+    *frame = copy;
+    hitCount.fetchAndAddRelaxed(1);
+    return true;
+}
+
+void DisplayMirror::onFinished(int mirrorGeneration)
+{
+    if (mirrorGeneration == generation)
+        emit finished();
+}
@@ -0,0 +1,85 @@
+#ifndef DISPLAYMIRROR_H
+#define DISPLAYMIRROR_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+#include "fileindex.h"
+#include "imageloader.h"
+
+struct MirrorJob;
+
+// A local copy of the source tree at display resolution, for sources on
+// slow storage: every file is decoded, scaled to a fixed width and stored
+// as a JPEG of a few hundred KB below the cache location, at the same
+// relative path. Each copy records the size and mtime of the file it was
+// made from, so a changed file shows up as stale and is made again on the
+// next pass, and the original size is still known when the copy stands in
+// for it.
+//
+// Copies are made on a worker pool. Source reads can be capped to a
+// number of bytes per second, so the mirror does not starve the slideshow
+// of bandwidth. Starting a new pass cancels the one in flight.
+class DisplayMirror : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        int made;
+        int fresh;       // already up to date
+        int failed;
+        int remaining;
+        qint64 bytesRead;
+        qint64 bytesWritten;
+        qint64 hits;     // loads served by decode()
+        qint64 misses;
+    };
+
+    explicit DisplayMirror(QObject *parent = nullptr);
+    ~DisplayMirror();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+    // Width copies are made at; narrower sources are copied as they are.
+    void setWidth(int width) { mirrorWidth = width; }
+    int width() const { return mirrorWidth; }
+    // 0 reads without a limit.
+    void setReadLimit(int megabytesPerSecond) { readLimit = megabytesPerSecond; }
+
+    // Bring the copies of ids of index up to date. index is kept until the
+    // pass is done.
+    void start(const FileIndex &index, const QVector<quint32> &ids);
+    // Queue a file the running index gained since start().
+    void add(const QString &fileName);
+    void cancel();
+    bool isRunning() const;
+    Stats stats() const;
+
+    static QString cacheDir(const QString &root);
+    // Where the copy of fileName, a file below root, is kept.
+    static QString mirrorPath(const QString &root, const QString &fileName);
+    // Decode the copy of fileName instead of the file, if it is up to date
+    // and has enough pixels for targetSize; see ImageLoader::decode(). The
+    // frame's sourceSize is that of the file. Safe to call from any thread.
+    static bool decode(const QString &root, const QString &fileName, const QSize &targetSize,
+                       ImageLoader::Frame *frame);
+
+signals:
+    void finished();
+
+private slots:
+    void onFinished(int generation);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<MirrorJob> job;
+    int generation;
+    int mirrorWidth;
+    int readLimit;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "displayscheduler.h"
+#include "trace.h"
+
+namespace {
+
+const qint64 nsPerMs = 1000000;
+
+} // namespace
+
+DisplayScheduler::DisplayScheduler(QObject *parent)
+    : QObject(parent)
+    , intervalMs(4000)
+    , deadline(0)
+    , tickDeadline(-1)
+    , tickStart(0)
+    , inTick(false)
+    , prepareMs(0)
+{
+    // The default coarse timers may fire up to 5% late, 200 ms at 4 s.
+    timer.setTimerType(Qt::PreciseTimer);
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &DisplayScheduler::fire);
+    clock.start();
+    resetStats();
+}
+
+void DisplayScheduler::setInterval(int ms)
+{
+    intervalMs = qBound<int>(MinInterval, ms, MaxInterval);
+}
+
+void DisplayScheduler::start()
+{
+    deadline = clock.nsecsElapsed() + intervalMs * nsPerMs;
+    tickDeadline = -1;
+    arm();
+}
+
+void DisplayScheduler::stop()
+{
+    timer.stop();
+    tickDeadline = -1;
+}
+
+void DisplayScheduler::frameShown()
+{
+    if (tickDeadline < 0)
+        return;
+    const qint64 now = clock.nsecsElapsed();
+    const double jitter = double(now - tickDeadline) / nsPerMs;
+    // Only a frame that was ready at the tick says how long preparing
+    // one takes; a late decode is up to the prefetch.
+    if (inTick)
+        prepareMs += (double(now - tickStart) / nsPerMs - prepareMs) / 8;
+    tickDeadline = -1;
+    shown++;
+    if (jitter > lateMs())
+        late++;
+    jitterSum += qAbs(jitter);
+    jitterMax = qMax(jitterMax, qAbs(jitter));
+}
+
+void DisplayScheduler::frameDropped()
+{
+    tickDeadline = -1;
+}
+
+// A display refresh, or a quarter of the interval at fast rates.
+int DisplayScheduler::lateMs() const
+{
+    return qMin(16, intervalMs / 4);
+}
+
+DisplayScheduler::Stats DisplayScheduler::stats() const
+{
+    Stats stats;
+    stats.ticks = ticks;
+    stats.shown = shown;
+    stats.late = late;
+    stats.skipped = skipped;
+    stats.meanJitterMs = shown > 0 ? jitterSum / shown : 0;
+    stats.maxJitterMs = jitterMax;
+    stats.leadMs = double(leadNs()) / nsPerMs;
+    return stats;
+}
+
+void DisplayScheduler::resetStats()
+{
+    ticks = 0;
+    shown = 0;
+    late = 0;
+    skipped = 0;
+    jitterSum = 0;
+    jitterMax = 0;
+}
+
+void DisplayScheduler::fire()
+{
+    TRACE_SPAN("DisplayScheduler::tick");
+    ticks++;
+    tickStart = clock.nsecsElapsed();
+    tickDeadline = deadline;
+    inTick = true;
+    emit tick();
+    inTick = false;
+
+    deadline += intervalMs * nsPerMs;
+    const qint64 now = clock.nsecsElapsed();
+    while (deadline < now) {
+        deadline += intervalMs * nsPerMs;
+        skipped++;
+    }
+    arm();
+}
+
+// Firing more than half an interval early would show frames out of step.
+qint64 DisplayScheduler::leadNs() const
+{
+    return qMin(qint64(prepareMs * nsPerMs), intervalMs * nsPerMs / 2);
+}
+
+void DisplayScheduler::arm()
+{
+    const qint64 wait = deadline - leadNs() - clock.nsecsElapsed();
+    timer.start(int(qMax<qint64>(0, wait / nsPerMs)));
+}
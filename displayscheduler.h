@@ -0,0 +1,80 @@
+#ifndef DISPLAYSCHEDULER_H
+#define DISPLAYSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+// Runs the slideshow against absolute deadlines: the n-th frame is due n
+// intervals after start(), however long the ticks before it took. tick()
+// fires ahead of each deadline by the time it recently took from a tick
+// to the frame being up, so that the frame lands on the deadline rather
+// than that much after it. A deadline that has already passed when the
+// next one is armed is skipped instead of being fired late.
+//
+// The viewer reports the frame each tick puts up with frameShown(), and
+// the gap to its deadline is kept as jitter; frames more than lateMs()
+// behind are counted as late.
+class DisplayScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum { MinInterval = 50, MaxInterval = 60000 }; // ms
+
+    struct Stats {
+        int ticks;
+        int shown;          // ticks whose frame went up
+        int late;
+        int skipped;        // deadlines passed over without a tick
+        double meanJitterMs; // mean of |shown - deadline|
+        double maxJitterMs;
+        double leadMs;      // how far ahead of its deadline a tick fires
+    };
+
+    explicit DisplayScheduler(QObject *parent = nullptr);
+
+    // Clamped to MinInterval..MaxInterval; takes effect on start().
+    void setInterval(int ms);
+    int interval() const { return intervalMs; }
+    // The first deadline is one interval from now.
+    void start();
+    void stop();
+    bool isActive() const { return timer.isActive(); }
+
+    // The frame of the last tick is up. Calls without a tick waiting for
+    // its frame are ignored.
+    void frameShown();
+    // The last tick will not put up a frame, e.g. while paused.
+    void frameDropped();
+    int lateMs() const;
+    Stats stats() const;
+    void resetStats();
+
+signals:
+    void tick();
+
+private slots:
+    void fire();
+
+private:
+    qint64 leadNs() const;
+    void arm();
+
+    QTimer timer;
+    QElapsedTimer clock;
+    int intervalMs;
+    qint64 deadline;     // ns on clock; of the next tick
+    qint64 tickDeadline; // of the frame the last tick is putting up, or -1
+    qint64 tickStart;
+    bool inTick;         // tick() is being emitted
+    double prepareMs;    // moving average of tick to frame shown
+    int ticks;
+    int shown;
+    int late;
+    int skipped;
+    double jitterSum;
+    double jitterMax;
+};
+
+#endif
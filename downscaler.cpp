@@ -0,0 +1,532 @@
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "downscaler.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DOWNSCALER_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define DOWNSCALER_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang compile the AVX2 functions for AVX2 without raising the
+// baseline of the whole file; MSVC accepts the intrinsics anywhere.
+#if defined(__GNUC__)
+#define DOWNSCALER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DOWNSCALER_TARGET_AVX2
+#endif
+
+namespace {
+
+// Images below this many source pixels are scaled on the calling thread.
+const qint64 bandingThreshold = 1 << 20;
+// Fewest rows worth handing to another thread.
+const int minBandRows = 16;
+
+// Vertical part of the box filter: add one source row to the per-channel
+// sums in acc.
+typedef void (*AddRowFunction)(const uchar *src, int bytes, quint32 *acc);
+// Horizontal part: sum fx neighbouring pixels of acc, scale and pack.
+typedef void (*ReduceFunction)(const quint32 *acc, int width, int fx, float scale, quint32 *dst);
+
+void addRowScalar(const uchar *src, int bytes, quint32 *acc)
+{
+    for (int i = 0; i < bytes; ++i)
+        acc[i] += src[i];
+}
+
+// Rounds half to even, like the SIMD conversions.
+void reduceScalar(const quint32 *acc, int width, int fx, float scale, quint32 *dst)
+{
+    for (int x = 0; x < width; ++x) {
+        quint32 sum[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < fx; ++i, acc += 4) {
+            sum[0] += acc[0];
+            sum[1] += acc[1];
+            sum[2] += acc[2];
+            sum[3] += acc[3];
+        }
+        quint32 pixel = 0;
+        for (int c = 0; c < 4; ++c)
+            pixel |= quint32(qMin(255L, std::lrint(float(sum[c]) * scale))) << (8 * c);
+        dst[x] = pixel;
+    }
+}
+
+#ifdef DOWNSCALER_SSE2
+void addRowSse2(const uchar *src, int bytes, quint32 *acc)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *a = reinterpret_cast<__m128i *>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+    addRowScalar(src + i, bytes - i, acc + i);
+}
+
+// One pixel's four channel sums fill a register exactly.
+void reduceSse2(const quint32 *acc, int width, int fx, float scale, quint32 *dst)
+{
+    const __m128 factor = _mm_set1_ps(scale);
+    for (int x = 0; x < width; ++x) {
+        __m128i sum = _mm_setzero_si128();
+        for (int i = 0; i < fx; ++i, acc += 4)
+            sum = _mm_add_epi32(sum, _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc)));
+        __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), factor));
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        dst[x] = quint32(_mm_cvtsi128_si32(v));
+    }
+}
+#endif
+
+// Conversion of one row to a display format. table is the premultiplied
+// or opaque colour table for Indexed8 and unused otherwise.
+typedef void (*ConvertRowFunction)(const uchar *src, int width, quint32 *dst, const quint32 *table);
+
+void grayRowScalar(const uchar *src, int width, quint32 *dst, const quint32 *)
+{
+    for (int x = 0; x < width; ++x)
+        dst[x] = 0xff000000u | (src[x] * 0x010101u);
+}
+
+void indexedRowScalar(const uchar *src, int width, quint32 *dst, const quint32 *table)
+{
+    for (int x = 0; x < width; ++x)
+        dst[x] = table[src[x]];
+}
+
+// RGB888 stores red first.
+void rgb888RowScalar(const uchar *src, int width, quint32 *dst, const quint32 *)
+{
+    for (int x = 0; x < width; ++x, src += 3)
+        dst[x] = 0xff000000u | (quint32(src[0]) << 16) | (quint32(src[1]) << 8) | src[2];
+}
+
+void premultiplyRowScalar(const uchar *src, int width, quint32 *dst, const quint32 *)
+{
+    const QRgb *pixels = reinterpret_cast<const QRgb *>(src);
+    for (int x = 0; x < width; ++x)
+        dst[x] = qPremultiply(pixels[x]);
+}
+
+#ifdef DOWNSCALER_SSE2
+void grayRowSse2(const uchar *src, int width, quint32 *dst, const quint32 *table)
+{
+    const __m128i alpha = _mm_set1_epi8(char(0xff));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+        // g g pairs and g ff pairs interleave to g g g ff.
+        const __m128i gg0 = _mm_unpacklo_epi8(v, v);
+        const __m128i gg1 = _mm_unpackhi_epi8(v, v);
+        const __m128i ga0 = _mm_unpacklo_epi8(v, alpha);
+        const __m128i ga1 = _mm_unpackhi_epi8(v, alpha);
+        __m128i *out = reinterpret_cast<__m128i *>(dst + x);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(gg0, ga0));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg0, ga0));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg1, ga1));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg1, ga1));
+    }
+    grayRowScalar(src + x, width - x, dst + x, table);
+}
+
+// Two pixels per register at 16 bits a channel. The alpha lanes are
+// multiplied by 255, which the rounding below turns back into alpha; the
+// result matches qPremultiply() exactly.
+inline __m128i premultiplyPair(__m128i pixels, __m128i rgbMask, __m128i alpha255)
+{
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)),
+                                    _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_or_si128(_mm_and_si128(a, rgbMask), alpha255);
+    const __m128i t = _mm_mullo_epi16(pixels, a);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), _mm_set1_epi16(0x80)), 8);
+}
+
+void premultiplyRowSse2(const uchar *src, int width, quint32 *dst, const quint32 *table)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgbMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i alpha255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * x));
+        const __m128i lo = premultiplyPair(_mm_unpacklo_epi8(v, zero), rgbMask, alpha255);
+        const __m128i hi = premultiplyPair(_mm_unpackhi_epi8(v, zero), rgbMask, alpha255);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    premultiplyRowScalar(src + 4 * x, width - x, dst + x, table);
+}
+#endif
+
+#ifdef DOWNSCALER_AVX2
+DOWNSCALER_TARGET_AVX2
+void grayRowAvx2(const uchar *src, int width, quint32 *dst, const quint32 *table)
+{
+    const __m256i spread = _mm256_set1_epi32(0x010101);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+                            _mm256_or_si256(_mm256_mullo_epi32(v, spread), alpha));
+    }
+    grayRowScalar(src + x, width - x, dst + x, table);
+}
+
+// Every AVX2 CPU has SSSE3's byte shuffle: four pixels of twelve bytes at
+// a time, reading no further than the end of the row.
+DOWNSCALER_TARGET_AVX2
+void rgb888RowAvx2(const uchar *src, int width, quint32 *dst, const quint32 *table)
+{
+    const __m128i order = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+    int x = 0;
+    for (; x + 6 <= width; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * x));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                         _mm_or_si128(_mm_shuffle_epi8(v, order), alpha));
+    }
+    rgb888RowScalar(src + 3 * x, width - x, dst + x, table);
+}
+
+DOWNSCALER_TARGET_AVX2
+void addRowAvx2(const uchar *src, int bytes, quint32 *acc)
+{
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m256i *a = reinterpret_cast<__m256i *>(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepu8_epi32(v)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1),
+                                                    _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    }
+    addRowScalar(src + i, bytes - i, acc + i);
+}
+
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // The OS has to save the YMM registers as well.
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#endif
+}
+#endif
+
+struct Kernels {
+    AddRowFunction addRow;
+    ReduceFunction reduce;
+};
+
+struct ConvertKernels {
+    ConvertRowFunction gray;
+    ConvertRowFunction indexed;
+    ConvertRowFunction rgb888;
+    ConvertRowFunction premultiply;
+};
+
+Kernels kernelsFor(Downscaler::Path path)
+{
+    switch (path) {
+#ifdef DOWNSCALER_AVX2
+    case Downscaler::Avx2:
+        return Kernels{ addRowAvx2, reduceSse2 };
+#endif
+#ifdef DOWNSCALER_SSE2
+    case Downscaler::Sse2:
+        return Kernels{ addRowSse2, reduceSse2 };
+#endif
+    default:
+        return Kernels{ addRowScalar, reduceScalar };
+    }
+}
+
+// A table lookup per pixel gains nothing from SSE2 or AVX2 without a fast
+// gather, so Indexed8 always goes through the scalar loop.
+ConvertKernels convertKernelsFor(Downscaler::Path path)
+{
+    switch (path) {
+#ifdef DOWNSCALER_AVX2
+    case Downscaler::Avx2:
+        return ConvertKernels{ grayRowAvx2, indexedRowScalar, rgb888RowAvx2, premultiplyRowSse2 };
+#endif
+#ifdef DOWNSCALER_SSE2
+    case Downscaler::Sse2:
+        return ConvertKernels{ grayRowSse2, indexedRowScalar, rgb888RowScalar, premultiplyRowSse2 };
+#endif
+    default:
+        return ConvertKernels{ grayRowScalar, indexedRowScalar, rgb888RowScalar, premultiplyRowScalar };
+    }
+}
+
+// Rows of one pass, split into bands that are claimed one at a time by
+// the caller and by helpers on the global pool. The caller never waits
+// for a band nobody has started, so a busy pool only costs parallelism.
+struct BandJob {
+    std::function<void(int, int)> run; // first row, end row
+    int rows;
+    int bands;
+    QAtomicInt next;
+    QSemaphore done;
+
+    void drain()
+    {
+        for (;;) {
+            const int band = next.fetchAndAddRelaxed(1);
+            if (band >= bands)
+                return;
+            run(int(qint64(rows) * band / bands), int(qint64(rows) * (band + 1) / bands));
+            done.release();
+        }
+    }
+};
+
+class BandTask : public QRunnable
+{
+public:
+    explicit BandTask(const QSharedPointer<BandJob> &job) : m_job(job) {}
+    void run() override { m_job->drain(); }
+
+private:
+    QSharedPointer<BandJob> m_job;
+};
+
+void forEachBand(int rows, int threads, const std::function<void(int, int)> &run)
+{
+    const int bands = qMax(1, qMin(threads, rows / minBandRows));
+    if (bands == 1) {
+        run(0, rows);
+        return;
+    }
+    QSharedPointer<BandJob> job(new BandJob);
+    job->run = run;
+    job->rows = rows;
+    job->bands = bands;
+    job->next.store(0);
+    for (int i = 1; i < bands; ++i)
+        QThreadPool::globalInstance()->start(new BandTask(job));
+    job->drain();
+    job->done.acquire(bands);
+}
+
+// Blend two ARGB32 pixels, w out of 256 towards b, two channels at a time.
+inline quint32 lerpPixel(quint32 a, quint32 b, int w)
+{
+    const quint32 rb = ((((a & 0x00ff00ff) * (256 - w)) + ((b & 0x00ff00ff) * w)) >> 8) & 0x00ff00ff;
+    const quint32 ag = ((((a >> 8) & 0x00ff00ff) * (256 - w)) + (((b >> 8) & 0x00ff00ff) * w)) & 0xff00ff00;
+    return rb | ag;
+}
+
+} // namespace
+
+Downscaler::Path Downscaler::bestPath()
+{
+#if defined(DOWNSCALER_AVX2)
+    static const Path best = cpuHasAvx2() ? Avx2 : Sse2;
+    return best;
+#elif defined(DOWNSCALER_SSE2)
+    return Sse2;
+#else
+    return Scalar;
+#endif
+}
+
+QString Downscaler::pathName(Path path)
+{
+    switch (path) {
+    case Avx2:
+        return QStringLiteral("avx2");
+    case Sse2:
+        return QStringLiteral("sse2");
+    default:
+        return QStringLiteral("scalar");
+    }
+}
+
+QImage Downscaler::scale(const QImage &image, const QSize &size, Path path, int threads)
+{
+    if (image.isNull() || size.isEmpty())
+        return QImage();
+    if (size == image.size())
+        return image;
+    if (size.width() > image.width() || size.height() > image.height())
+        return image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    TRACE_SPAN("Downscaler::scale");
+
+    if (threads <= 0) {
+        threads = qint64(image.width()) * image.height() < bandingThreshold
+            ? 1 : QThread::idealThreadCount();
+    }
+    const QImage src = toDisplayFormat(image, path, threads);
+    const Kernels kernels = kernelsFor(qMin(path, bestPath()));
+
+    // Whole blocks leave the box result at least as large as size and
+    // less than twice as large. Rows and columns that do not fill a block
+    // are split between the two edges.
+    const int fx = qMax(1, src.width() / size.width());
+    const int fy = qMax(1, src.height() / size.height());
+    QImage box = src;
+    if (fx > 1 || fy > 1) {
+        box = QImage(src.width() / fx, src.height() / fy, src.format());
+        const int x0 = (src.width() - box.width() * fx) / 2;
+        const int y0 = (src.height() - box.height() * fy) / 2;
+        const float scale = 1.0f / float(fx * fy);
+        const uchar *srcBits = src.constBits();
+        const int srcStride = src.bytesPerLine();
+        uchar *boxBits = box.bits();
+        const int boxStride = box.bytesPerLine();
+        const int boxWidth = box.width();
+        forEachBand(box.height(), threads, [=](int first, int end) {
+            QVector<quint32> acc(boxWidth * fx * 4);
+            for (int y = first; y < end; ++y) {
+                std::fill(acc.begin(), acc.end(), 0u);
+                const uchar *row = srcBits + qint64(y0 + y * fy) * srcStride + x0 * 4;
+                for (int r = 0; r < fy; ++r, row += srcStride)
+                    kernels.addRow(row, acc.size(), acc.data());
+                kernels.reduce(acc.constData(), boxWidth, fx, scale,
+                               reinterpret_cast<quint32 *>(boxBits + qint64(y) * boxStride));
+            }
+        });
+    }
+    if (box.size() == size)
+        return box;
+
+    // What is left is a reduction by less than two, where a bilinear
+    // filter still samples every pixel.
+    QImage dst(size, src.format());
+    const float rx = float(box.width()) / size.width();
+    const float ry = float(box.height()) / size.height();
+    QVector<int> xa(size.width()), xb(size.width()), wx(size.width());
+    for (int x = 0; x < size.width(); ++x) {
+        const float sx = qBound(0.0f, (x + 0.5f) * rx - 0.5f, float(box.width() - 1));
+        xa[x] = int(sx);
+        xb[x] = qMin(xa[x] + 1, box.width() - 1);
+        wx[x] = int((sx - xa[x]) * 256 + 0.5f);
+    }
+    const uchar *boxBits = box.constBits();
+    const int boxStride = box.bytesPerLine();
+    const int boxHeight = box.height();
+    uchar *dstBits = dst.bits();
+    const int dstStride = dst.bytesPerLine();
+    const int dstWidth = dst.width();
+    forEachBand(size.height(), threads, [&](int first, int end) {
+        for (int y = first; y < end; ++y) {
+            const float sy = qBound(0.0f, (y + 0.5f) * ry - 0.5f, float(boxHeight - 1));
+            const int ya = int(sy);
+            const int yb = qMin(ya + 1, boxHeight - 1);
+            const int wy = int((sy - ya) * 256 + 0.5f);
+            const quint32 *rowA = reinterpret_cast<const quint32 *>(boxBits + qint64(ya) * boxStride);
+            const quint32 *rowB = reinterpret_cast<const quint32 *>(boxBits + qint64(yb) * boxStride);
+            quint32 *out = reinterpret_cast<quint32 *>(dstBits + qint64(y) * dstStride);
+            for (int x = 0; x < dstWidth; ++x) {
+                out[x] = lerpPixel(lerpPixel(rowA[xa[x]], rowA[xb[x]], wx[x]),
+                                   lerpPixel(rowB[xa[x]], rowB[xb[x]], wx[x]), wy);
+            }
+        }
+    });
+    return dst;
+}
+
+bool Downscaler::isDisplayFormat(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+QImage Downscaler::toDisplayFormat(const QImage &image, Path path, int threads)
+{
+    if (image.isNull() || isDisplayFormat(image.format()))
+        return image;
+    TRACE_SPAN("Downscaler::toDisplayFormat");
+    const ConvertKernels kernels = convertKernelsFor(qMin(path, bestPath()));
+    QImage::Format format = QImage::Format_RGB32;
+    ConvertRowFunction convertRow;
+    QVector<quint32> table;
+    switch (image.format()) {
+    case QImage::Format_Grayscale8:
+        convertRow = kernels.gray;
+        break;
+    case QImage::Format_RGB888:
+        convertRow = kernels.rgb888;
+        break;
+    case QImage::Format_ARGB32:
+        format = QImage::Format_ARGB32_Premultiplied;
+        convertRow = kernels.premultiply;
+        break;
+    case QImage::Format_Indexed8: {
+        // Indices past the end of the colour table come out black.
+        const QVector<QRgb> colors = image.colorTable();
+        const bool alpha = image.hasAlphaChannel();
+        if (alpha)
+            format = QImage::Format_ARGB32_Premultiplied;
+        table.fill(0xff000000u, 256);
+        for (int i = 0; i < qMin(256, colors.size()); ++i)
+            table[i] = alpha ? qPremultiply(colors.at(i)) : 0xff000000u | colors.at(i);
+        convertRow = kernels.indexed;
+        break;
+    }
+    default:
+        return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                             : QImage::Format_RGB32);
+    }
+
+    QImage dst(image.size(), format);
+    if (dst.isNull())
+        return dst;
+    dst.setDotsPerMeterX(image.dotsPerMeterX());
+    dst.setDotsPerMeterY(image.dotsPerMeterY());
+    dst.setDevicePixelRatio(image.devicePixelRatio());
+    if (threads <= 0) {
+        threads = qint64(image.width()) * image.height() < bandingThreshold
+            ? 1 : QThread::idealThreadCount();
+    }
+    const uchar *srcBits = image.constBits();
+    const int srcStride = image.bytesPerLine();
+    uchar *dstBits = dst.bits();
+    const int dstStride = dst.bytesPerLine();
+    const int width = image.width();
+    const quint32 *colors = table.constData();
+    forEachBand(image.height(), threads, [=](int first, int end) {
+        for (int y = first; y < end; ++y) {
+            convertRow(srcBits + qint64(y) * srcStride, width,
+                       reinterpret_cast<quint32 *>(dstBits + qint64(y) * dstStride), colors);
+        }
+    });
+    return dst;
+}
@@ -0,0 +1,41 @@
+#ifndef DOWNSCALER_H
+#define DOWNSCALER_H
+
+#include <QImage>
+#include <QSize>
+
+// Shrinks RGB32 and premultiplied ARGB32 images for display. An area
+// (box) filter averages whole blocks of source pixels down to less than
+// twice the target size, and a bilinear pass takes it the rest of the way.
+// The box pass touches every source pixel and has SSE2 and AVX2 versions,
+// picked at run time; large images are split into bands of rows that run
+// on the global thread pool.
+//
+// The same goes for bringing decoded images into those two formats, which
+// QPixmap also takes without converting, so decoders' other formats are
+// converted once, on the worker, rather than on every upload.
+class Downscaler
+{
+public:
+    enum Path { Scalar, Sse2, Avx2 };
+
+    // The fastest path this CPU supports.
+    static Path bestPath();
+    static QString pathName(Path path);
+
+    // Scale image to exactly size, ignoring the aspect ratio. Enlarging is
+    // left to QImage::scaled(). Other formats are converted first; the
+    // result is RGB32 or ARGB32_Premultiplied. path is capped at
+    // bestPath(); threads 0 picks a count from the image size.
+    static QImage scale(const QImage &image, const QSize &size,
+                        Path path = bestPath(), int threads = 0);
+
+    // RGB32, or ARGB32_Premultiplied for images with an alpha channel.
+    static bool isDisplayFormat(QImage::Format format);
+    // image in a display format. Grayscale8, Indexed8, RGB888 and ARGB32
+    // have their own paths; other formats are left to Qt. Images already
+    // in a display format are returned as they are.
+    static QImage toDisplayFormat(const QImage &image, Path path = bestPath(), int threads = 0);
+};
+
+#endif
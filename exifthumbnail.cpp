@@ -0,0 +1,148 @@
+#include <QFile>
+#include <QImageIOHandler>
+#include <QTransform>
+
+#include "exifthumbnail.h"
+#include "trace.h"
+
+namespace {
+
+// Reads the numbers of a TIFF structure in its byte order; anything out
+// of range reads as 0.
+class TiffReader
+{
+public:
+    explicit TiffReader(const QByteArray &data)
+        : d(reinterpret_cast<const uchar *>(data.constData())), size(data.size())
+        , littleEndian(data.startsWith("II")) {}
+
+    bool contains(quint32 offset, quint32 length) const
+    {
+        return quint64(offset) + length <= quint64(size);
+    }
+
+    quint32 u16(quint32 offset) const
+    {
+        if (!contains(offset, 2))
+            return 0;
+        return littleEndian ? d[offset] | (d[offset + 1] << 8)
+                            : (d[offset] << 8) | d[offset + 1];
+    }
+
+    quint32 u32(quint32 offset) const
+    {
+        if (!contains(offset, 4))
+            return 0;
+        return littleEndian ? u16(offset) | (u16(offset + 2) << 16)
+                            : (u16(offset) << 16) | u16(offset + 2);
+    }
+
+    // Value of a SHORT or LONG entry, which sits in the entry itself.
+    quint32 value(quint32 entry) const
+    {
+        return u16(entry + 2) == 3 ? u16(entry + 8) : u32(entry + 8);
+    }
+
+    const uchar *d;
+    const int size;
+    const bool littleEndian;
+};
+
+// EXIF orientation as Qt's transformation: mirror, then flip, then
+// rotate 90 degrees clockwise.
+QImageIOHandler::Transformations transformation(quint32 orientation)
+{
+    switch (orientation) {
+    case 2: return QImageIOHandler::TransformationMirror;
+    case 3: return QImageIOHandler::TransformationRotate180;
+    case 4: return QImageIOHandler::TransformationFlip;
+    case 5: return QImageIOHandler::TransformationFlipAndRotate90;
+    case 6: return QImageIOHandler::TransformationRotate90;
+    case 7: return QImageIOHandler::TransformationMirrorAndRotate90;
+    case 8: return QImageIOHandler::TransformationRotate270;
+    default: return QImageIOHandler::TransformationNone;
+    }
+}
+
+} // namespace
+
+QImage ExifThumbnail::read(const QString &fileName)
+{
+    TRACE_SPAN("ExifThumbnail::read");
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QImage();
+    uchar marker[4];
+    if (file.read(reinterpret_cast<char *>(marker), 2) != 2 || marker[0] != 0xff || marker[1] != 0xd8)
+        return QImage();
+    // EXIF lives in an APPn segment, and those all come right after SOI.
+    for (int segment = 0; segment < 16; ++segment) {
+        if (file.read(reinterpret_cast<char *>(marker), 4) != 4 || marker[0] != 0xff)
+            return QImage();
+        const int type = marker[1];
+        const int length = (marker[2] << 8) | marker[3]; // includes itself
+        if (type < 0xe0 || type > 0xef || length < 2)
+            return QImage();
+        if (type == 0xe1 && length > 8) {
+            const QByteArray data = file.read(length - 2);
+            // XMP also lives in APP1, under another header.
+            if (data.size() == length - 2 && data.startsWith(QByteArray("Exif\0\0", 6)))
+                return fromTiff(data.mid(6));
+        } else if (!file.seek(file.pos() + length - 2)) {
+            return QImage();
+        }
+    }
+    return QImage();
+}
+
+QImage ExifThumbnail::fromTiff(const QByteArray &tiff)
+{
+    if (!tiff.startsWith("II") && !tiff.startsWith("MM"))
+        return QImage();
+    const TiffReader reader(tiff);
+    if (reader.u16(2) != 42)
+        return QImage();
+
+    // IFD0 describes the image and links to IFD1, the thumbnail's.
+    const quint32 ifd0 = reader.u32(4);
+    const quint32 count0 = reader.u16(ifd0);
+    if (!reader.contains(ifd0 + 2, count0 * 12 + 4))
+        return QImage();
+    quint32 orientation = 1;
+    for (quint32 i = 0; i < count0; ++i) {
+        const quint32 entry = ifd0 + 2 + i * 12;
+        if (reader.u16(entry) == 0x0112)
+            orientation = reader.u16(entry + 8);
+    }
+    const quint32 ifd1 = reader.u32(ifd0 + 2 + count0 * 12);
+    const quint32 count1 = reader.u16(ifd1);
+    if (ifd1 == 0 || !reader.contains(ifd1 + 2, count1 * 12))
+        return QImage();
+    quint32 offset = 0;
+    quint32 length = 0;
+    for (quint32 i = 0; i < count1; ++i) {
+        const quint32 entry = ifd1 + 2 + i * 12;
+        switch (reader.u16(entry)) {
+        case 0x0201: // JPEGInterchangeFormat
+            offset = reader.value(entry);
+            break;
+        case 0x0202: // JPEGInterchangeFormatLength
+            length = reader.value(entry);
+            break;
+        }
+    }
+    if (offset == 0 || length == 0 || !reader.contains(offset, length))
+        return QImage();
+
+    QImage image = QImage::fromData(reader.d + offset, int(length), "JPEG");
+    if (image.isNull())
+        return image;
+    const QImageIOHandler::Transformations t = transformation(orientation);
+    const bool mirror = t.testFlag(QImageIOHandler::TransformationMirror);
+    const bool flip = t.testFlag(QImageIOHandler::TransformationFlip);
+    if (mirror || flip)
+        image = image.mirrored(mirror, flip);
+    if (t.testFlag(QImageIOHandler::TransformationRotate90))
+        image = image.transformed(QTransform().rotate(90));
+    return image;
+}
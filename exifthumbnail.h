@@ -0,0 +1,23 @@
+#ifndef EXIFTHUMBNAIL_H
+#define EXIFTHUMBNAIL_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+// The preview JPEG that cameras embed in the EXIF block of a JPEG file
+// (IFD1 of the APP1 segment), typically 160x120. Only the segments ahead
+// of the image data are read, a few KB, so it is available long before
+// the file itself has been decoded.
+class ExifThumbnail
+{
+public:
+    // The embedded preview of fileName with the EXIF orientation applied,
+    // or a null image if there is none.
+    static QImage read(const QString &fileName);
+    // The same from the TIFF structure of an APP1 segment, after its
+    // "Exif\0\0" header.
+    static QImage fromTiff(const QByteArray &tiff);
+};
+
+#endif
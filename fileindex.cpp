@@ -0,0 +1,818 @@
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QPair>
+#include <QRegExp>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QDebug>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include "fileindex.h"
+
+namespace {
+
+// On-disk layout: header, dir records, file records, UTF-8 string pool.
+// Every record is a multiple of 8 bytes so the mapped file can be read in
+// place.
+const char indexMagic[8] = { 'I', 'V', 'I', 'N', 'D', 'E', 'X', 0 };
+const quint32 indexVersion = 3;
+
+struct IndexHeader {
+    char magic[8];
+    quint32 version;
+    quint32 dirCount;
+    quint32 fileCount;
+    quint32 stringsSize;
+    quint32 rootOffset;
+    quint32 rootLength;
+    quint32 patternOffset;
+    quint32 patternLength;
+    quint32 shuffleCount;
+    quint32 shuffleSeed;
+    quint32 shufflePosition;
+    quint32 reserved;
+};
+
+struct DirRecord {
+    qint64 mtime;
+    quint32 pathOffset;
+    quint32 pathLength;
+    qint32 parent;
+    quint32 firstFile;
+    quint32 fileCount;
+    quint32 reserved;
+};
+
+struct FileRecord {
+    qint64 size;
+    qint64 mtime;
+    quint32 nameOffset;
+    quint32 nameLength;
+    quint32 width;
+    quint32 height;
+    quint8 state;
+    quint8 transformation;
+    quint8 format;
+    quint8 shown;
+    quint8 reserved[4];
+};
+
+// Matches names against a wildcard pattern, case-insensitively like QDir.
+class NameMatcher
+{
+public:
+    explicit NameMatcher(const QString &pattern)
+    {
+        // "*.ext" is by far the common case; compare the raw bytes for it.
+        if (pattern.startsWith(QLatin1String("*."))
+            && pattern.indexOf(QRegExp(QStringLiteral("[*?\\[]")), 1) < 0)
+            suffix = pattern.mid(1).toUtf8();
+        else
+            regExp = QRegExp(pattern, Qt::CaseInsensitive, QRegExp::Wildcard);
+    }
+
+    bool matches(const char *name, int length) const
+    {
+        if (suffix.isEmpty())
+            return regExp.exactMatch(QString::fromUtf8(name, length));
+        return length >= suffix.size()
+            && qstrnicmp(name + length - suffix.size(), suffix.constData(), suffix.size()) == 0;
+    }
+
+    bool matches(const QString &name) const
+    {
+        const QByteArray utf8 = name.toUtf8();
+        return matches(utf8.constData(), utf8.size());
+    }
+
+private:
+    QByteArray suffix;
+    QRegExp regExp;
+};
+
+#ifdef Q_OS_UNIX
+qint64 statModificationTime(const struct stat &st)
+{
+#if defined(Q_OS_LINUX)
+    return qint64(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+#elif defined(Q_OS_DARWIN)
+    return qint64(st.st_mtimespec.tv_sec) * 1000 + st.st_mtimespec.tv_nsec / 1000000;
+#else
+    return qint64(st.st_mtime) * 1000;
+#endif
+}
+#endif
+
+quint32 appendString(QByteArray *strings, const QString &s, quint32 *length)
+{
+    const quint32 offset = strings->size();
+    const QByteArray utf8 = s.toUtf8();
+    strings->append(utf8);
+    *length = utf8.size();
+    return offset;
+}
+
+} // namespace
+
+FileIndex::FileIndex()
+    : liveCount(0)
+    , liveShown(0)
+    , liveUnshown(0)
+{
+    shuffle.count = 0;
+    shuffle.seed = 0;
+    shuffle.position = 0;
+}
+
+quint32 FileIndex::appendEntry(const QString &name, qint64 size, qint64 mtime, int dir)
+{
+    const QByteArray utf8 = name.toUtf8();
+    Entry entry;
+    entry.nameOffset = names.size();
+    entry.nameLength = utf8.size();
+    entry.dir = dir;
+    entry.state = Unprobed;
+    entry.transformation = 0;
+    entry.format = 0;
+    entry.shown = 0;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.width = 0;
+    entry.height = 0;
+    names.append(utf8);
+    entries.append(entry);
+    liveCount++;
+    tally(entry, 1);
+    filesByDir[dir].append(entries.size() - 1);
+    return entries.size() - 1;
+}
+
+QString FileIndex::nameOf(const Entry &entry) const
+{
+    return QString::fromUtf8(names.constData() + entry.nameOffset, entry.nameLength);
+}
+
+FileIndex::File FileIndex::fileAt(quint32 id) const
+{
+    const Entry &entry = entries.at(id);
+    File file;
+    file.name = nameOf(entry);
+    file.size = entry.size;
+    file.mtime = entry.mtime;
+    file.dir = entry.dir;
+    return file;
+}
+
+FileIndex::Meta FileIndex::metaAt(quint32 id) const
+{
+    const Entry &entry = entries.at(id);
+    Meta meta;
+    meta.width = entry.width;
+    meta.height = entry.height;
+    meta.state = entry.state;
+    meta.transformation = entry.transformation;
+    meta.format = entry.format;
+    return meta;
+}
+
+void FileIndex::setMeta(quint32 id, const Meta &meta)
+{
+    Entry &entry = entries[id];
+    tally(entry, -1);
+    entry.width = meta.width;
+    entry.height = meta.height;
+    entry.state = meta.state;
+    entry.transformation = meta.transformation;
+    entry.format = meta.format;
+    tally(entry, 1);
+}
+
+void FileIndex::markUnreadable(quint32 id)
+{
+    Entry &entry = entries[id];
+    tally(entry, -1);
+    entry.state = Unreadable;
+    tally(entry, 1);
+}
+
+FileIndex::ProbeStats FileIndex::probeStats() const
+{
+    ProbeStats stats = { 0, 0 };
+    foreach (const Entry &entry, entries) {
+        if (entry.dir < 0 || entry.state == Unprobed)
+            continue;
+        stats.probed++;
+        if (entry.state == Unreadable)
+            stats.unreadable++;
+    }
+    return stats;
+}
+
+void FileIndex::setShown(quint32 id, bool shown)
+{
+    Entry &entry = entries[id];
+    tally(entry, -1);
+    entry.shown = shown;
+    tally(entry, 1);
+}
+
+void FileIndex::clearShown()
+{
+    for (int i = 0; i < entries.size(); ++i)
+        setShown(i, false);
+}
+
+void FileIndex::tally(const Entry &entry, int sign)
+{
+    if (entry.dir < 0)
+        return;
+    if (entry.shown)
+        liveShown += sign;
+    else if (entry.state != Unreadable)
+        liveUnshown += sign;
+}
+
+void FileIndex::mergeMeta(const FileIndex &older)
+{
+    const DirLookup mine = dirLookup();
+    const DirLookup theirs = older.dirLookup();
+    for (int d = 0; d < dirs.size(); ++d) {
+        const int o = theirs.byPath.value(dirs.at(d).path, -1);
+        if (o < 0)
+            continue;
+        QHash<QByteArray, quint32> byName;
+        byName.reserve(theirs.files.at(o).size());
+        foreach (quint32 id, theirs.files.at(o)) {
+            const Entry &entry = older.entries.at(id);
+            if (entry.state != Unprobed || entry.shown)
+                byName.insert(QByteArray::fromRawData(older.names.constData() + entry.nameOffset,
+                                                      entry.nameLength), id);
+        }
+        if (byName.isEmpty())
+            continue;
+        foreach (quint32 id, mine.files.at(d)) {
+            Entry &entry = entries[id];
+            const QByteArray name = QByteArray::fromRawData(names.constData() + entry.nameOffset,
+                                                            entry.nameLength);
+            const QHash<QByteArray, quint32>::const_iterator it = byName.constFind(name);
+            if (it == byName.constEnd())
+                continue;
+            const Entry &old = older.entries.at(it.value());
+            if (old.size == entry.size && old.mtime == entry.mtime)
+                setMeta(id, older.metaAt(it.value()));
+            setShown(id, old.shown);
+        }
+    }
+}
+
+QString FileIndex::filePath(quint32 id) const
+{
+    const Entry &entry = entries.at(id);
+    if (entry.dir < 0)
+        return QString();
+    return dirs.at(entry.dir).path + QLatin1Char('/') + nameOf(entry);
+}
+
+qint64 FileIndex::findFile(int dir, const QString &name) const
+{
+    const QByteArray utf8 = name.toUtf8();
+    foreach (quint32 id, filesByDir.at(dir)) {
+        const Entry &entry = entries.at(id);
+        if (entry.nameLength == quint32(utf8.size())
+            && memcmp(names.constData() + entry.nameOffset, utf8.constData(), utf8.size()) == 0)
+            return id;
+    }
+    return -1;
+}
+
+qint64 FileIndex::findFile(const QString &path) const
+{
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    const int d = findDir(path.left(slash));
+    return d < 0 ? -1 : findFile(d, path.mid(slash + 1));
+}
+
+QVector<qint64> FileIndex::findFiles(const QStringList &paths) const
+{
+    QVector<qint64> result(paths.size(), -1);
+
+    // Wanted names by directory, so only the files of those are compared.
+    QHash<int, QVector<QPair<QByteArray, int> > > wanted;
+    for (int i = 0; i < paths.size(); ++i) {
+        const QString &path = paths.at(i);
+        const int slash = path.lastIndexOf(QLatin1Char('/'));
+        const int d = findDir(path.left(slash));
+        if (d >= 0)
+            wanted[d].append(qMakePair(path.mid(slash + 1).toUtf8(), i));
+    }
+    for (QHash<int, QVector<QPair<QByteArray, int> > >::const_iterator it = wanted.constBegin();
+         it != wanted.constEnd(); ++it) {
+        foreach (quint32 id, filesByDir.at(it.key())) {
+            const Entry &entry = entries.at(id);
+            for (const QPair<QByteArray, int> &name : it.value()) {
+                if (entry.nameLength == quint32(name.first.size())
+                    && memcmp(names.constData() + entry.nameOffset, name.first.constData(), entry.nameLength) == 0)
+                    result[name.second] = id;
+            }
+        }
+    }
+    return result;
+}
+
+QVector<FileIndex::File> FileIndex::filesOf(int dir) const
+{
+    QVector<File> result;
+    result.reserve(filesByDir.at(dir).size());
+    foreach (quint32 id, filesByDir.at(dir))
+        result.append(fileAt(id));
+    return result;
+}
+
+FileIndex::DirLookup FileIndex::dirLookup() const
+{
+    DirLookup lookup;
+    lookup.byPath.reserve(dirs.size());
+    lookup.children.resize(dirs.size());
+    lookup.files = filesByDir;
+    for (int i = 0; i < dirs.size(); ++i) {
+        const Dir &dir = dirs.at(i);
+        lookup.byPath.insert(dir.path, i);
+        if (dir.parent >= 0)
+            lookup.children[dir.parent].append(i);
+    }
+    return lookup;
+}
+
+qint64 FileIndex::memoryUsage() const
+{
+    qint64 bytes = sizeof(FileIndex)
+        + qint64(entries.capacity()) * sizeof(Entry)
+        + names.capacity()
+        + qint64(dirs.capacity()) * sizeof(Dir)
+        // Roughly a pointer, hash and int per node, and the bucket array.
+        + qint64(dirsByPath.capacity()) * sizeof(void *)
+        + qint64(dirsByPath.size()) * (2 * sizeof(void *) + 2 * sizeof(int))
+        + qint64(filesByDir.capacity()) * sizeof(QVector<quint32>);
+    foreach (const Dir &dir, dirs)
+        bytes += dir.path.capacity() * sizeof(QChar);
+    foreach (const QVector<quint32> &ids, filesByDir)
+        bytes += qint64(ids.capacity()) * sizeof(quint32);
+    return bytes;
+}
+
+double FileIndex::bytesPerFile() const
+{
+    return liveCount ? double(memoryUsage()) / liveCount : 0.0;
+}
+
+void FileIndex::setRoot(const QString &root, const QString &pattern)
+{
+    rootPath = root;
+    namePattern = pattern;
+}
+
+int FileIndex::appendDir(const QString &path, qint64 mtime, int parent, const QVector<File> &dirFiles)
+{
+    const int dirIndex = dirs.size();
+    Dir dir;
+    dir.path = path;
+    dir.mtime = mtime;
+    dir.parent = parent;
+    dirs.append(dir);
+    dirsByPath.insert(path, dirIndex);
+    filesByDir.append(QVector<quint32>());
+    filesByDir.last().reserve(dirFiles.size());
+    entries.reserve(entries.size() + dirFiles.size());
+    foreach (const File &file, dirFiles)
+        appendEntry(file.name, file.size, file.mtime, dirIndex);
+    return dirIndex;
+}
+
+int FileIndex::findDir(const QString &path) const
+{
+    return dirsByPath.value(path, -1);
+}
+
+void FileIndex::rebuildLookups()
+{
+    dirsByPath.clear();
+    dirsByPath.reserve(dirs.size());
+    for (int i = 0; i < dirs.size(); ++i)
+        dirsByPath.insert(dirs.at(i).path, i);
+    filesByDir = QVector<QVector<quint32> >(dirs.size());
+    for (int i = 0; i < entries.size(); ++i) {
+        const int dir = entries.at(i).dir;
+        if (dir >= 0)
+            filesByDir[dir].append(i);
+    }
+}
+
+bool FileIndex::matches(const QString &fileName) const
+{
+    return !fileName.startsWith(QLatin1Char('.')) && NameMatcher(namePattern).matches(fileName);
+}
+
+bool FileIndex::addFile(const QString &path, qint64 size, qint64 mtime)
+{
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    const int d = findDir(path.left(slash));
+    if (d < 0)
+        return false;
+    const QString name = path.mid(slash + 1);
+    const qint64 existing = findFile(d, name);
+    if (existing >= 0) {
+        Entry &entry = entries[existing];
+        tally(entry, -1);
+        if (entry.size != size || entry.mtime != mtime)
+            entry.state = Unprobed;
+        tally(entry, 1);
+        entry.size = size;
+        entry.mtime = mtime;
+        return false;
+    }
+    appendEntry(name, size, mtime, d);
+    return true;
+}
+
+bool FileIndex::removeFile(const QString &path)
+{
+    const qint64 id = findFile(path);
+    if (id < 0)
+        return false;
+    // The id stays dead until the index is replaced; save() drops it.
+    filesByDir[entries.at(id).dir].removeOne(quint32(id));
+    tally(entries.at(id), -1);
+    entries[id].dir = -1;
+    liveCount--;
+    return true;
+}
+
+int FileIndex::addDir(const QString &path, qint64 mtime, const QVector<File> &dirFiles)
+{
+    const int existing = findDir(path);
+    if (existing >= 0)
+        return existing;
+    const int parent = findDir(path.left(path.lastIndexOf(QLatin1Char('/'))));
+    if (parent < 0)
+        return -1;
+    return appendDir(path, mtime, parent, dirFiles);
+}
+
+QStringList FileIndex::removeDir(const QString &path)
+{
+    QStringList removed;
+    const int top = findDir(path);
+    if (top < 0)
+        return removed;
+
+    // Parents always precede their children, so one pass finds the subtree.
+    QVector<int> remap(dirs.size(), -1);
+    QVector<Dir> keptDirs;
+    keptDirs.reserve(dirs.size());
+    for (int i = 0; i < dirs.size(); ++i) {
+        const Dir &dir = dirs.at(i);
+        const bool inTree = i == top || (dir.parent >= 0 && remap.at(dir.parent) < 0);
+        if (inTree)
+            continue;
+        remap[i] = keptDirs.size();
+        Dir kept = dir;
+        kept.parent = dir.parent >= 0 ? remap.at(dir.parent) : -1;
+        keptDirs.append(kept);
+    }
+    for (int i = 0; i < entries.size(); ++i) {
+        Entry &entry = entries[i];
+        if (entry.dir < 0)
+            continue;
+        if (remap.at(entry.dir) < 0) {
+            removed.append(filePath(i));
+            liveCount--;
+            tally(entry, -1);
+        }
+        entry.dir = remap.at(entry.dir);
+    }
+    dirs = keptDirs;
+    rebuildLookups();
+    return removed;
+}
+
+bool FileIndex::listDir(const QString &path, const QString &pattern,
+                        QVector<File> *files, QStringList *subdirs)
+{
+    const NameMatcher matcher(pattern);
+    const QString prefix = path + QLatin1Char('/');
+#ifdef Q_OS_UNIX
+    DIR *dir = opendir(QFile::encodeName(path).constData());
+    if (!dir)
+        return false;
+    const int fd = dirfd(dir);
+    while (struct dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        // Skips ".", ".." and hidden entries, as QDir does by default.
+        if (name[0] == '.')
+            continue;
+        struct stat st;
+        bool haveStat = false;
+        bool isDir = entry->d_type == DT_DIR;
+        bool isFile = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN) {
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            haveStat = true;
+            isDir = S_ISDIR(st.st_mode);
+            isFile = S_ISREG(st.st_mode);
+        }
+        if (isDir) {
+            subdirs->append(prefix + QFile::decodeName(name));
+        } else if (isFile && matcher.matches(name, int(strlen(name)))) {
+            if (!haveStat && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            File file;
+            file.name = QFile::decodeName(name);
+            file.size = st.st_size;
+            file.mtime = statModificationTime(st);
+            file.dir = -1;
+            files->append(file);
+        }
+    }
+    closedir(dir);
+    return true;
+#else
+    if (!QFileInfo(path).isDir())
+        return false;
+    QDirIterator it(path, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        if (info.isDir()) {
+            subdirs->append(prefix + info.fileName());
+        } else if (matcher.matches(info.fileName())) {
+            File file;
+            file.name = info.fileName();
+            file.size = info.size();
+            file.mtime = info.lastModified().toMSecsSinceEpoch();
+            file.dir = -1;
+            files->append(file);
+        }
+    }
+    return true;
+#endif
+}
+
+qint64 FileIndex::modificationTime(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (stat(QFile::encodeName(path).constData(), &st) != 0)
+        return -1;
+    return statModificationTime(st);
+#else
+    const QFileInfo info(path);
+    return info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+#endif
+}
+
+FileIndex FileIndex::scan(const QString &root, const QString &pattern,
+                          const FileIndex &previous, ScanStats *stats)
+{
+    QElapsedTimer timer;
+    timer.start();
+    FileIndex index;
+    index.setRoot(root, pattern);
+    const bool reuse = previous.rootPath == root && previous.namePattern == pattern;
+    const DirLookup lookup = reuse ? previous.dirLookup() : DirLookup();
+
+    ScanStats local = { 0, 0, 0, 0 };
+    struct Pending {
+        QString path;
+        int parent;
+    };
+    // Depth first, files before subdirectories.
+    QVector<Pending> stack;
+    stack.append(Pending{ root, -1 });
+    while (!stack.isEmpty()) {
+        const Pending next = stack.takeLast();
+        const qint64 mtime = modificationTime(next.path);
+        QVector<File> dirFiles;
+        QStringList subdirs;
+        const int old = lookup.byPath.value(next.path, -1);
+        if (old >= 0 && previous.dirs.at(old).mtime == mtime) {
+            foreach (quint32 id, lookup.files.at(old))
+                dirFiles.append(previous.fileAt(id));
+            foreach (int child, lookup.children.at(old))
+                subdirs.append(previous.dirs.at(child).path);
+            local.dirsReused++;
+        } else {
+            listDir(next.path, pattern, &dirFiles, &subdirs);
+            local.dirsListed++;
+        }
+        const int dirIndex = index.appendDir(next.path, mtime, next.parent, dirFiles);
+        for (int i = subdirs.size() - 1; i >= 0; --i)
+            stack.append(Pending{ subdirs.at(i), dirIndex });
+    }
+
+    local.files = index.liveCount;
+    local.elapsedMs = timer.elapsed();
+    if (stats)
+        *stats = local;
+    return index;
+}
+
+bool FileIndex::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(IndexHeader)))
+        return false;
+    uchar *data = file.map(0, fileSize);
+    if (!data)
+        return false;
+
+    bool ok = false;
+    const IndexHeader *header = reinterpret_cast<const IndexHeader *>(data);
+    const qint64 expected = qint64(sizeof(IndexHeader))
+        + qint64(header->dirCount) * sizeof(DirRecord)
+        + qint64(header->fileCount) * sizeof(FileRecord)
+        + header->stringsSize;
+    if (memcmp(header->magic, indexMagic, sizeof(indexMagic)) == 0
+        && header->version == indexVersion && expected == fileSize) {
+        const DirRecord *dirRecords = reinterpret_cast<const DirRecord *>(header + 1);
+        const FileRecord *fileRecords = reinterpret_cast<const FileRecord *>(dirRecords + header->dirCount);
+        const char *strings = reinterpret_cast<const char *>(fileRecords + header->fileCount);
+        const quint32 stringsSize = header->stringsSize;
+        auto inStrings = [&](quint32 offset, quint32 length) -> bool {
+            return qint64(offset) + length <= stringsSize;
+        };
+
+        // File names are copied into the arena as they are, so the string
+        // pool is never decoded to UTF-16 here.
+        bool valid = inStrings(header->rootOffset, header->rootLength)
+            && inStrings(header->patternOffset, header->patternLength);
+        quint32 nextFile = 0;
+        FileIndex loaded;
+        loaded.dirs.reserve(header->dirCount);
+        loaded.entries.reserve(header->fileCount);
+        loaded.names.reserve(stringsSize);
+        for (quint32 d = 0; valid && d < header->dirCount; ++d) {
+            const DirRecord &record = dirRecords[d];
+            if (record.parent >= qint32(d) || record.parent < -1
+                || record.firstFile != nextFile
+                || qint64(record.firstFile) + record.fileCount > header->fileCount
+                || !inStrings(record.pathOffset, record.pathLength)) {
+                valid = false;
+                break;
+            }
+            nextFile += record.fileCount;
+            Dir dir;
+            dir.path = QString::fromUtf8(strings + record.pathOffset, record.pathLength);
+            dir.mtime = record.mtime;
+            dir.parent = record.parent;
+            loaded.dirs.append(dir);
+            for (quint32 f = record.firstFile; f < record.firstFile + record.fileCount; ++f) {
+                const FileRecord &fileRecord = fileRecords[f];
+                if (!inStrings(fileRecord.nameOffset, fileRecord.nameLength)) {
+                    valid = false;
+                    break;
+                }
+                Entry entry;
+                entry.nameOffset = loaded.names.size();
+                entry.nameLength = fileRecord.nameLength;
+                entry.dir = d;
+                entry.state = fileRecord.state <= Unreadable ? fileRecord.state : quint8(Unprobed);
+                entry.transformation = fileRecord.transformation;
+                entry.format = fileRecord.format;
+                entry.shown = fileRecord.shown != 0;
+                entry.size = fileRecord.size;
+                entry.mtime = fileRecord.mtime;
+                entry.width = fileRecord.width;
+                entry.height = fileRecord.height;
+                loaded.names.append(strings + fileRecord.nameOffset, fileRecord.nameLength);
+                loaded.entries.append(entry);
+                loaded.tally(entry, 1);
+            }
+        }
+        if (nextFile != header->fileCount)
+            valid = false;
+        if (valid) {
+            loaded.rootPath = QString::fromUtf8(strings + header->rootOffset, header->rootLength);
+            loaded.namePattern = QString::fromUtf8(strings + header->patternOffset, header->patternLength);
+            loaded.liveCount = loaded.entries.size();
+            if (header->shufflePosition <= header->shuffleCount
+                && header->shuffleCount <= header->fileCount) {
+                loaded.shuffle.count = header->shuffleCount;
+                loaded.shuffle.seed = header->shuffleSeed;
+                loaded.shuffle.position = header->shufflePosition;
+            }
+            loaded.rebuildLookups();
+            *this = loaded;
+            ok = true;
+        }
+    }
+    file.unmap(data);
+    if (!ok)
+        qDebug() << "Ignoring invalid index" << fileName;
+    return ok;
+}
+
+bool FileIndex::save(const QString &fileName) const
+{
+    QByteArray strings;
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.version = indexVersion;
+    header.dirCount = dirs.size();
+    header.fileCount = liveCount;
+    header.rootOffset = appendString(&strings, rootPath, &header.rootLength);
+    header.patternOffset = appendString(&strings, namePattern, &header.patternLength);
+
+    // On disk the files are grouped by directory and dead ids are dropped.
+    QVector<int> counts(dirs.size() + 1, 0);
+    foreach (const Entry &entry, entries) {
+        if (entry.dir >= 0)
+            counts[entry.dir + 1]++;
+    }
+    for (int d = 0; d < dirs.size(); ++d)
+        counts[d + 1] += counts[d];
+
+    QVector<DirRecord> dirRecords(dirs.size());
+    for (int d = 0; d < dirs.size(); ++d) {
+        const Dir &dir = dirs.at(d);
+        DirRecord &record = dirRecords[d];
+        memset(&record, 0, sizeof(record));
+        record.mtime = dir.mtime;
+        record.pathOffset = appendString(&strings, dir.path, &record.pathLength);
+        record.parent = dir.parent;
+        record.firstFile = counts.at(d);
+        record.fileCount = counts.at(d + 1) - counts.at(d);
+    }
+    QVector<FileRecord> fileRecords(liveCount);
+    memset(fileRecords.data(), 0, fileRecords.size() * sizeof(FileRecord));
+    QVector<int> next = counts;
+    // The shuffle pass is over the ids, so it only survives if every file
+    // comes back under the id it has now.
+    bool sameIds = true;
+    for (int i = 0; i < entries.size(); ++i) {
+        const Entry &entry = entries.at(i);
+        if (entry.dir < 0) {
+            sameIds = false;
+            continue;
+        }
+        if (next.at(entry.dir) != i)
+            sameIds = false;
+        FileRecord &record = fileRecords[next[entry.dir]++];
+        record.size = entry.size;
+        record.mtime = entry.mtime;
+        record.nameOffset = strings.size();
+        record.nameLength = entry.nameLength;
+        record.width = entry.width;
+        record.height = entry.height;
+        record.state = entry.state;
+        record.transformation = entry.transformation;
+        record.format = entry.format;
+        record.shown = entry.shown;
+        strings.append(names.constData() + entry.nameOffset, entry.nameLength);
+    }
+    header.stringsSize = strings.size();
+    if (sameIds) {
+        header.shuffleCount = shuffle.count;
+        header.shuffleSeed = shuffle.seed;
+        header.shufflePosition = shuffle.position;
+    }
+
+    QSaveFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly))
+        return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(dirRecords.constData()), dirRecords.size() * sizeof(DirRecord));
+    out.write(reinterpret_cast<const char *>(fileRecords.constData()), fileRecords.size() * sizeof(FileRecord));
+    out.write(strings);
+    return out.commit();
+}
+
+QString FileIndex::defaultLocation()
+{
+#ifdef Q_OS_WIN
+    // Native settings live in the registry, so use the local app data folder.
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+#else
+    QSettings settings(QCoreApplication::organizationName(), QCoreApplication::applicationName());
+    const QString dir = QFileInfo(settings.fileName()).absolutePath();
+#endif
+    QDir().mkpath(dir);
+    return dir + QStringLiteral("/fileindex.bin");
+}
@@ -0,0 +1,197 @@
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// Snapshot of the image files below a source directory. It is persisted
+// in a flat binary file so the next start can reuse it and only re-list
+// directories whose modification time changed.
+//
+// In memory every directory path is stored once, and each file is a
+// fixed-size entry holding its directory and the offset of its UTF-8 name
+// in a shared arena. Files are addressed by 32-bit ids that stay valid
+// until the index is replaced; full paths are only built on demand.
+class FileIndex
+{
+public:
+    struct Dir {
+        QString path;
+        qint64 mtime;   // ms since epoch
+        int parent;     // -1 for the root
+    };
+    // Unpacked form of a file entry, as listed or looked up.
+    struct File {
+        QString name;
+        qint64 size;
+        qint64 mtime;
+        int dir;
+    };
+    // A directory with all of its files, in the order it was added.
+    struct DirEntries {
+        QString path;
+        qint64 mtime;
+        int parent;
+        QVector<File> files;
+    };
+    struct ScanStats {
+        int files;
+        int dirsListed;
+        int dirsReused;
+        qint64 elapsedMs;
+    };
+    // What a header probe found out about a file, see HeaderProber.
+    enum ProbeState { Unprobed, Readable, Unreadable };
+    struct Meta {
+        quint32 width;          // as stored, before the EXIF transformation
+        quint32 height;
+        quint8 state;           // ProbeState
+        quint8 transformation;  // QImageIOHandler::Transformations
+        quint8 format;          // see HeaderProber::formatName()
+    };
+    struct ProbeStats {
+        int probed;
+        int unreadable;
+    };
+    // How far the slideshow's ShuffleBag got through its pass over the ids.
+    // A count of 0 means there is no pass to resume.
+    struct ShufflePass {
+        quint32 count;
+        quint32 seed;
+        quint32 position;
+    };
+    // Directories of an index by path, with the children and files of
+    // each, used to reuse unchanged directories while rescanning.
+    struct DirLookup {
+        QHash<QString, int> byPath;
+        QVector<QVector<int> > children;
+        QVector<QVector<quint32> > files;
+    };
+
+    FileIndex();
+
+    QString root() const { return rootPath; }
+    QString pattern() const { return namePattern; }
+    bool isEmpty() const { return liveCount == 0; }
+    int fileCount() const { return liveCount; }
+    int dirCount() const { return dirs.size(); }
+    // Ids run from 0 to idCount() - 1; removed files leave dead ids.
+    quint32 idCount() const { return entries.size(); }
+    bool isLive(quint32 id) const { return entries.at(id).dir >= 0; }
+    int dirOf(quint32 id) const { return entries.at(id).dir; }
+    bool isUnreadable(quint32 id) const { return entries.at(id).state == Unreadable; }
+    // Whether the slideshow picked the file in its current round.
+    bool isShown(quint32 id) const { return entries.at(id).shown; }
+    void setShown(quint32 id, bool shown);
+    void clearShown();
+    // Live files shown in the round, and readable ones not shown yet. Both
+    // are kept up to date as the index changes.
+    int shownCount() const { return liveShown; }
+    int unshownCount() const { return liveUnshown; }
+    // Saved with the shown flags, so a restart carries on with the pass.
+    // save() drops it when it renumbers the ids, i.e. when files were
+    // removed, or added to a folder other than the last, since the scan.
+    ShufflePass shufflePass() const { return shuffle; }
+    void setShufflePass(const ShufflePass &pass) { shuffle = pass; }
+    // Id of the live file at path, or -1.
+    qint64 findFile(const QString &path) const;
+    // The same for many paths at once, visiting each of their directories
+    // once, e.g. to carry ids over when the index is replaced.
+    QVector<qint64> findFiles(const QStringList &paths) const;
+
+    const Dir &dirAt(int i) const { return dirs.at(i); }
+    File fileAt(quint32 id) const;
+    QString filePath(quint32 id) const;
+    QVector<File> filesOf(int dir) const;
+    // Header metadata, kept with the file and saved in the index file.
+    // Changing a file's size or mtime resets it to Unprobed.
+    Meta metaAt(quint32 id) const;
+    void setMeta(quint32 id, const Meta &meta);
+    void markUnreadable(quint32 id);
+    ProbeStats probeStats() const;
+    // Copy the metadata of every unchanged file and the shown flag of every
+    // file over from older, matching files by path, e.g. after a rescan
+    // built a fresh index.
+    void mergeMeta(const FileIndex &older);
+    DirLookup dirLookup() const;
+    // Bytes held by the index, in total and per live file.
+    qint64 memoryUsage() const;
+    double bytesPerFile() const;
+
+    // Building an index out of order: a directory is appended together
+    // with all of its files, and always after its parent.
+    void setRoot(const QString &root, const QString &pattern);
+    int appendDir(const QString &path, qint64 mtime, int parent, const QVector<File> &dirFiles);
+
+    // Incremental updates from a directory watcher. Paths are absolute.
+    int findDir(const QString &path) const;
+    bool matches(const QString &fileName) const;
+    // Returns false if the file's directory is unknown or the file was
+    // already indexed (its size and mtime are refreshed then).
+    bool addFile(const QString &path, qint64 size, qint64 mtime);
+    bool removeFile(const QString &path);
+    // Adds path below its (already indexed) parent; returns the new index,
+    // the existing one if path is known, or -1.
+    int addDir(const QString &path, qint64 mtime, const QVector<File> &dirFiles);
+    // Removes path and everything below it and returns the removed files.
+    QStringList removeDir(const QString &path);
+
+    // List the files matching pattern and the subdirectories of path, using
+    // readdir() where available. Hidden entries and symlinks are skipped,
+    // and nothing is sorted. File::dir is left unset.
+    static bool listDir(const QString &path, const QString &pattern,
+                        QVector<File> *files, QStringList *subdirs);
+    // Modification time in ms since epoch, or -1 if path cannot be read.
+    static qint64 modificationTime(const QString &path);
+
+    // Build the index for root, re-using every directory of previous whose
+    // mtime is unchanged. Runs entirely on the calling thread; see
+    // IndexScanner for the parallel version.
+    static FileIndex scan(const QString &root, const QString &pattern,
+                          const FileIndex &previous = FileIndex(),
+                          ScanStats *stats = nullptr);
+
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+    // Index file kept next to the application's settings.
+    static QString defaultLocation();
+
+private:
+    struct Entry {
+        quint32 nameOffset;
+        quint32 nameLength;
+        qint32 dir;     // -1 once removed
+        quint8 state;
+        quint8 transformation;
+        quint8 format;
+        quint8 shown;
+        qint64 size;
+        qint64 mtime;
+        quint32 width;
+        quint32 height;
+    };
+
+    quint32 appendEntry(const QString &name, qint64 size, qint64 mtime, int dir);
+    QString nameOf(const Entry &entry) const;
+    qint64 findFile(int dir, const QString &name) const;
+    void rebuildLookups();
+    // Add entry to, or with sign -1 take it off, the shown counts.
+    void tally(const Entry &entry, int sign);
+
+    QString rootPath;
+    QString namePattern;
+    QVector<Dir> dirs;
+    QHash<QString, int> dirsByPath; // for the watcher's lookups
+    QVector<QVector<quint32> > filesByDir; // live ids of each dir
+    QVector<Entry> entries;
+    QByteArray names;
+    int liveCount;
+    int liveShown;
+    int liveUnshown;
+    ShufflePass shuffle;
+};
+
+#endif
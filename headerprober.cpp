@@ -0,0 +1,242 @@
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include "headerprober.h"
+#include "trace.h"
+
+namespace {
+
+// Results collected before the GUI is told about a new batch, and the
+// longest it waits for a batch to fill up.
+const int batchSize = 256;
+const int batchIntervalMs = 250;
+
+// Index 0 stands for any format not listed.
+const char *const formatNames[] = { "", "jpeg", "png", "gif", "bmp", "webp", "tiff", "heic", "jp2" };
+const int formatCount = int(sizeof(formatNames) / sizeof(formatNames[0]));
+
+quint8 formatId(const QByteArray &name)
+{
+    for (int i = 1; i < formatCount; ++i) {
+        if (name == formatNames[i])
+            return quint8(i);
+    }
+    return 0;
+}
+
+struct ProbeItem {
+    quint32 id;
+    QString fileName; // empty for files of the job's index
+};
+
+} // namespace
+
+struct ProbeJob
+{
+    ProbeJob(HeaderProber *prober, int generation, const FileIndex &index)
+        : prober(prober), generation(generation), index(index), cancelled(0)
+        , next(0), workers(0), notified(false)
+    {
+        sinceNotify.start();
+    }
+
+    // Take the next file to probe, or retire the calling worker.
+    bool take(ProbeItem *item, bool *last)
+    {
+        QMutexLocker locker(&mutex);
+        if (cancelled.load() || next == items.size()) {
+            *last = --workers == 0 && !cancelled.load();
+            return false;
+        }
+        *item = items.at(next++);
+        return true;
+    }
+
+    void append(const HeaderProber::Result &result)
+    {
+        QMutexLocker locker(&mutex);
+        results.append(result);
+        if (!notified && (results.size() >= batchSize || sinceNotify.elapsed() >= batchIntervalMs)) {
+            notified = true;
+            QMetaObject::invokeMethod(prober, "onProgress", Qt::QueuedConnection,
+                                      Q_ARG(int, generation));
+        }
+    }
+
+    HeaderProber *prober;
+    const int generation;
+    const FileIndex index;
+    QAtomicInt cancelled;
+
+    QMutex mutex;           // guards everything below
+    QVector<ProbeItem> items;
+    int next;
+    int workers;            // workers that have not exited yet
+    QVector<HeaderProber::Result> results;
+    bool notified;
+    QElapsedTimer sinceNotify;
+};
+
+namespace {
+
+class ProbeWorker : public QRunnable
+{
+public:
+    explicit ProbeWorker(const QSharedPointer<ProbeJob> &job) : m_job(job) {}
+
+    void run() override
+    {
+        ProbeItem item;
+        bool last = false;
+        while (m_job->take(&item, &last)) {
+            HeaderProber::Result result;
+            result.id = item.id;
+            result.meta = HeaderProber::probe(item.fileName.isEmpty() ? m_job->index.filePath(item.id)
+                                                                      : item.fileName);
+            m_job->append(result);
+        }
+        if (last)
+            QMetaObject::invokeMethod(m_job->prober, "onFinished", Qt::QueuedConnection,
+                                      Q_ARG(int, m_job->generation));
+    }
+
+private:
+    QSharedPointer<ProbeJob> m_job;
+};
+
+} // namespace
+
+HeaderProber::HeaderProber(QObject *parent)
+    : QObject(parent)
+    , generation(0)
+{
+    pool.setMaxThreadCount(2);
+}
+
+HeaderProber::~HeaderProber()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void HeaderProber::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int HeaderProber::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void HeaderProber::start(const FileIndex &index, const QVector<quint32> &ids)
+{
+    cancel();
+    generation++;
+    job = QSharedPointer<ProbeJob>(new ProbeJob(this, generation, index));
+    job->items.reserve(ids.size());
+    foreach (quint32 id, ids)
+        job->items.append(ProbeItem{ id, QString() });
+    job->workers = qMin(pool.maxThreadCount(), ids.size());
+    for (int i = 0; i < job->workers; ++i)
+        pool.start(new ProbeWorker(job));
+}
+
+void HeaderProber::add(quint32 id, const QString &fileName)
+{
+    if (!job || job->cancelled.load()) {
+        generation++;
+        job = QSharedPointer<ProbeJob>(new ProbeJob(this, generation, FileIndex()));
+    }
+    QMutexLocker locker(&job->mutex);
+    job->items.append(ProbeItem{ id, fileName });
+    if (job->workers < pool.maxThreadCount()) {
+        job->workers++;
+        pool.start(new ProbeWorker(job));
+    }
+}
+
+void HeaderProber::cancel()
+{
+    if (job)
+        job->cancelled.store(1);
+}
+
+bool HeaderProber::isRunning() const
+{
+    if (!job || job->cancelled.load())
+        return false;
+    QMutexLocker locker(&job->mutex);
+    return job->workers > 0;
+}
+
+int HeaderProber::remaining() const
+{
+    if (!job || job->cancelled.load())
+        return 0;
+    QMutexLocker locker(&job->mutex);
+    return job->items.size() - job->next;
+}
+
+QVector<HeaderProber::Result> HeaderProber::takeResults()
+{
+    QVector<Result> results;
+    if (job && !job->cancelled.load()) {
+        QMutexLocker locker(&job->mutex);
+        results.swap(job->results);
+        job->notified = false;
+        job->sinceNotify.restart();
+    }
+    return results;
+}
+
+FileIndex::Meta HeaderProber::probe(const QString &fileName)
+{
+    TRACE_SPAN("HeaderProber::probe");
+    FileIndex::Meta meta = { 0, 0, FileIndex::Unreadable, 0, 0 };
+    QImageReader reader(fileName);
+    // Both only parse the header; nothing is decoded.
+    const QSize size = reader.size();
+    if (!reader.canRead() || size.isEmpty())
+        return meta;
+    meta.width = size.width();
+    meta.height = size.height();
+    meta.state = FileIndex::Readable;
+    meta.transformation = quint8(int(reader.transformation()));
+    meta.format = formatId(reader.format());
+    return meta;
+}
+
+QSize HeaderProber::displaySize(const FileIndex::Meta &meta)
+{
+    if (meta.state != FileIndex::Readable)
+        return QSize();
+    const QSize size(meta.width, meta.height);
+    return meta.transformation & QImageIOHandler::TransformationRotate90 ? size.transposed() : size;
+}
+
+QByteArray HeaderProber::formatName(quint8 format)
+{
+    return QByteArray(formatNames[format < formatCount ? format : 0]);
+}
+
+void HeaderProber::onProgress(int probeGeneration)
+{
+    if (probeGeneration == generation)
+        emit progress();
+}
+
+void HeaderProber::onFinished(int probeGeneration)
+{
+    if (probeGeneration != generation)
+        return;
+    // The last results may not have been announced yet.
+    emit progress();
+    emit finished();
+}
@@ -0,0 +1,65 @@
+#ifndef HEADERPROBER_H
+#define HEADERPROBER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QSize>
+#include <QThreadPool>
+
+#include "fileindex.h"
+
+struct ProbeJob;
+
+// Reads just the headers of the files in a FileIndex on a pool of worker
+// threads: stored size, EXIF transformation, format and whether a reader
+// accepts the file at all. Results are streamed out in batches, keyed by
+// the ids of the index the probe was started on. Starting a new probe
+// cancels the one in flight.
+class HeaderProber : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Result {
+        quint32 id;
+        FileIndex::Meta meta;
+    };
+
+    explicit HeaderProber(QObject *parent = nullptr);
+    ~HeaderProber();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+
+    // Probe ids of index. The index is only read from the workers, so
+    // a copy of it is kept until the probe is done.
+    void start(const FileIndex &index, const QVector<quint32> &ids);
+    // Queue a file the running index gained since start().
+    void add(quint32 id, const QString &fileName);
+    void cancel();
+    bool isRunning() const;
+    // Files queued and not probed yet.
+    int remaining() const;
+    // Results since the last call.
+    QVector<Result> takeResults();
+
+    static FileIndex::Meta probe(const QString &fileName);
+    // The size a probed file is shown at, after the EXIF transformation.
+    static QSize displaySize(const FileIndex::Meta &meta);
+    static QByteArray formatName(quint8 format);
+
+signals:
+    void progress();
+    void finished();
+
+private slots:
+    void onProgress(int generation);
+    void onFinished(int generation);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<ProbeJob> job;
+    int generation;
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImageWriter>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTextStream>
+#include <QThread>
+#include <QtMath>
+
+#include <algorithm>
+
+#include "displayscheduler.h"
+#include "downscaler.h"
+#include "fileindex.h"
+#include "headerprober.h"
+#include "headless.h"
+#include "imageloader.h"
+#include "imageviewer.h"
+#include "indexscanner.h"
+#include "trace.h"
+
+namespace {
+
+double msSince(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+void print(const QJsonObject &report)
+{
+    QTextStream(stdout) << QJsonDocument(report).toJson();
+}
+
+QJsonObject sizeObject(const QSize &size)
+{
+    QJsonObject object;
+    object.insert("width", size.width());
+    object.insert("height", size.height());
+    return object;
+}
+
+// Keeps the event loop of the viewer and its workers' results going.
+void processEventsFor(int ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+        QThread::msleep(1);
+    } while (timer.elapsed() < ms);
+}
+
+} // namespace
+
+int Headless::scan(const QString &dir)
+{
+    TRACE_SPAN("Headless::scan");
+    const QString root = QDir(dir).absolutePath();
+    if (!QFileInfo(root).isDir()) {
+        qWarning("%s is not a folder", qPrintable(QDir::toNativeSeparators(root)));
+        return 1;
+    }
+    const QString pattern = QStringLiteral("*.jpg");
+    QSettings settings(QCoreApplication::organizationName(), QCoreApplication::applicationName());
+    const int scanThreads = qMax(1, settings.value("scanThreads", qMax(4, QThread::idealThreadCount())).toInt());
+    const int probeThreads = qMax(1, settings.value("probeThreads", 2).toInt());
+
+    FileIndex saved;
+    const bool reused = saved.load(FileIndex::defaultLocation())
+        && saved.root() == root && saved.pattern() == pattern;
+    if (!reused)
+        saved = FileIndex();
+
+    QEventLoop loop;
+    IndexScanner scanner;
+    scanner.setMaxThreads(scanThreads);
+    QObject::connect(&scanner, &IndexScanner::finished, &loop, &QEventLoop::quit);
+    scanner.start(root, pattern, saved);
+    loop.exec();
+    FileIndex index = scanner.result();
+    index.mergeMeta(saved);
+    const FileIndex::ScanStats scanStats = scanner.stats();
+
+    QVector<quint32> ids;
+    for (quint32 id = 0; id < index.idCount(); ++id) {
+        if (index.isLive(id) && index.metaAt(id).state == FileIndex::Unprobed)
+            ids.append(id);
+    }
+    QElapsedTimer timer;
+    timer.start();
+    HeaderProber prober;
+    prober.setMaxThreads(probeThreads);
+    if (!ids.isEmpty()) {
+        QObject::connect(&prober, &HeaderProber::finished, &loop, &QEventLoop::quit);
+        prober.start(index, ids);
+        loop.exec();
+    }
+    foreach (const HeaderProber::Result &result, prober.takeResults())
+        index.setMeta(result.id, result.meta);
+    const qint64 probeMs = timer.elapsed();
+    const FileIndex::ProbeStats probeStats = index.probeStats();
+
+    const QString location = FileIndex::defaultLocation();
+    if (!index.save(location)) {
+        qWarning("Cannot write index %s", qPrintable(QDir::toNativeSeparators(location)));
+        return 1;
+    }
+
+    QJsonObject report;
+    report.insert("root", root);
+    report.insert("index", location);
+    report.insert("revalidated", reused);
+    report.insert("files", index.fileCount());
+    report.insert("dirs", index.dirCount());
+    report.insert("dirsListed", scanStats.dirsListed);
+    report.insert("dirsReused", scanStats.dirsReused);
+    report.insert("scanMs", scanStats.elapsedMs);
+    report.insert("filesPerSecond", qRound64(scanStats.files * 1000.0 / qMax<qint64>(1, scanStats.elapsedMs)));
+    report.insert("headersProbed", ids.size());
+    report.insert("probeMs", probeMs);
+    report.insert("unreadable", probeStats.unreadable);
+    report.insert("indexBytes", index.memoryUsage());
+    report.insert("bytesPerFile", index.bytesPerFile());
+    print(report);
+    return 0;
+}
+
+// loadFile() probes the header, decodes for the window and ImageView
+// scales the frame to the device pixels it covers; the same steps here.
+int Headless::render(const QString &fileName, const QSize &size, const QString &outFile)
+{
+    TRACE_SPAN("Headless::render");
+    QElapsedTimer timer;
+    timer.start();
+    const FileIndex::Meta meta = HeaderProber::probe(fileName);
+    const double probeMs = msSince(timer);
+    if (meta.state != FileIndex::Readable) {
+        qWarning("Cannot load %s: not a readable image", qPrintable(QDir::toNativeSeparators(fileName)));
+        return 1;
+    }
+    // ImageViewer::displayTargetSize(): the window's width in device pixels.
+    const double dpr = qGuiApp->devicePixelRatio();
+    const QSize target(qRound(size.width() * dpr), 0);
+
+    timer.start();
+    const ImageLoader::Frame frame = ImageLoader::decode(fileName, target);
+    const double decodeMs = msSince(timer);
+    if (frame.image.isNull()) {
+        qWarning("Cannot load %s: %s", qPrintable(QDir::toNativeSeparators(fileName)),
+                 qPrintable(frame.errorString));
+        return 1;
+    }
+
+    // fitWindowTo() takes the height from the frame, and ImageView scales
+    // to the device pixels the window then covers.
+    const int height = int(double(frame.image.height()) * size.width() / frame.image.width());
+    const QSize shown(qRound(size.width() * dpr), qRound(height * dpr));
+
+    timer.start();
+    const QImage image = Downscaler::scale(frame.image, shown);
+    const double scaleMs = msSince(timer);
+
+    timer.start();
+    QImageWriter writer(outFile);
+    if (!writer.write(image)) {
+        qWarning("Cannot write %s: %s", qPrintable(QDir::toNativeSeparators(outFile)),
+                 qPrintable(writer.errorString()));
+        return 1;
+    }
+    const double writeMs = msSince(timer);
+
+    QJsonObject report;
+    report.insert("file", fileName);
+    report.insert("out", outFile);
+    report.insert("sourceSize", sizeObject(frame.sourceSize));
+    report.insert("decodedSize", sizeObject(frame.image.size()));
+    report.insert("outputSize", sizeObject(image.size()));
+    report.insert("probeMs", probeMs);
+    report.insert("decodeMs", decodeMs);
+    report.insert("scaleMs", scaleMs);
+    report.insert("writeMs", writeMs);
+    print(report);
+    return 0;
+}
+
+// The viewer's own timer is stopped and changeFile() is called directly,
+// so every tick is timed as a whole: picking, taking the prefetched frame,
+// showing it and queueing the next decodes. The same number of ticks is
+// then run by the display scheduler with the tick gap as its interval, to
+// see how close frames come to their deadlines.
+int Headless::bench(const QString &dir, int ticks, int tickGapMs)
+{
+    TRACE_SPAN("Headless::bench");
+    const QString root = QDir(dir).absolutePath();
+    if (!QFileInfo(root).isDir()) {
+        qWarning("%s is not a folder", qPrintable(QDir::toNativeSeparators(root)));
+        return 1;
+    }
+    ImageViewer viewer(root);
+    viewer.stopDisplayLoop();
+    viewer.show();
+
+    // Ticks should not compete with the scan and header probe for the disk.
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        processEventsFor(10);
+    } while (viewer.isIndexing());
+    const qint64 indexMs = timer.elapsed();
+
+    QVector<double> samples;
+    const int missesBefore = viewer.tickMissCount();
+    for (int i = 0; i < ticks; ++i) {
+        processEventsFor(tickGapMs);
+        timer.start();
+        QMetaObject::invokeMethod(&viewer, "changeFile", Qt::DirectConnection);
+        samples.append(msSince(timer));
+    }
+    const int misses = viewer.tickMissCount() - missesBefore;
+
+    DisplayScheduler *scheduler = viewer.displayScheduler();
+    scheduler->setInterval(tickGapMs);
+    scheduler->resetStats();
+    QEventLoop loop;
+    int scheduled = 0;
+    QObject::connect(scheduler, &DisplayScheduler::tick, &loop, [&]() {
+        if (++scheduled >= ticks)
+            loop.quit();
+    });
+    scheduler->start();
+    loop.exec();
+    scheduler->stop();
+    const DisplayScheduler::Stats schedule = scheduler->stats();
+    QJsonObject deadlines;
+    deadlines.insert("intervalMs", scheduler->interval());
+    deadlines.insert("ticks", schedule.ticks);
+    deadlines.insert("shown", schedule.shown);
+    deadlines.insert("late", schedule.late);
+    deadlines.insert("misses", viewer.tickMissCount() - missesBefore - misses);
+    deadlines.insert("lateMs", scheduler->lateMs());
+    deadlines.insert("skipped", schedule.skipped);
+    deadlines.insert("meanJitterMs", schedule.meanJitterMs);
+    deadlines.insert("maxJitterMs", schedule.maxJitterMs);
+    deadlines.insert("leadMs", schedule.leadMs);
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    foreach (double sample, samples)
+        sum += sample;
+    // Nearest rank.
+    auto percentile = [&samples](double p) {
+        const int rank = qMax(1, qCeil(p / 100.0 * samples.size()));
+        return samples.at(qMin(rank, samples.size()) - 1);
+    };
+
+    QJsonObject report;
+    report.insert("root", root);
+    report.insert("indexMs", indexMs);
+    report.insert("windowSize", sizeObject(viewer.size()));
+    report.insert("ticks", samples.size());
+    report.insert("tickGapMs", tickGapMs);
+    report.insert("misses", misses);
+    report.insert("unit", "ms");
+    if (!samples.isEmpty()) {
+        report.insert("mean", sum / samples.size());
+        report.insert("min", samples.first());
+        report.insert("p50", percentile(50));
+        report.insert("p90", percentile(90));
+        report.insert("p99", percentile(99));
+        report.insert("max", samples.last());
+    }
+    report.insert("deadlines", deadlines);
+    print(report);
+    return 0;
+}
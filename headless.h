@@ -0,0 +1,26 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QSize>
+#include <QString>
+
+// The command-line modes that run without a display, on the offscreen
+// platform, for profiling over SSH and for automated runs. Each goes
+// through the same code the viewer uses, prints one JSON document to
+// stdout and returns the process exit code.
+class Headless
+{
+public:
+    // Build or revalidate the index of dir, probe the new headers and save
+    // it where the viewer looks for it.
+    static int scan(const QString &dir);
+    // Decode and scale fileName as the viewer does for a window of size's
+    // width, whose height then follows the image, and write the result to
+    // outFile.
+    static int render(const QString &fileName, const QSize &size, const QString &outFile);
+    // Time ticks slideshow ticks of a viewer showing dir, with the
+    // configured window size and prefetch settings, tickGapMs apart.
+    static int bench(const QString &dir, int ticks, int tickGapMs);
+};
+
+#endif
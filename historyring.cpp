@@ -0,0 +1,71 @@
+#include "historyring.h"
+
+HistoryRing::HistoryRing(int capacity)
+    : ids(qMax(1, capacity))
+    , head(0)
+    , count(0)
+    , cursor(0)
+{
+}
+
+void HistoryRing::setCapacity(int capacity)
+{
+    const QVector<quint32> kept = toVector();
+    ids = QVector<quint32>(qMax(1, capacity));
+    clear();
+    for (int i = qMax(0, kept.size() - ids.size()); i < kept.size(); ++i)
+        push(kept.at(i));
+}
+
+void HistoryRing::clear()
+{
+    head = 0;
+    count = 0;
+    cursor = 0;
+}
+
+void HistoryRing::push(quint32 id)
+{
+    ids[head] = id;
+    head = (head + 1) % ids.size();
+    count = qMin(count + 1, ids.size());
+    cursor = 0;
+}
+
+bool HistoryRing::back(quint32 *id)
+{
+    if (cursor + 1 >= count)
+        return false;
+    cursor++;
+    *id = at(cursor);
+    return true;
+}
+
+bool HistoryRing::forward(quint32 *id)
+{
+    if (cursor == 0)
+        return false;
+    cursor--;
+    *id = at(cursor);
+    return true;
+}
+
+void HistoryRing::setPosition(int age)
+{
+    cursor = qBound(0, age, qMax(0, count - 1));
+}
+
+quint32 HistoryRing::at(int age) const
+{
+    Q_ASSERT(age >= 0 && age < count);
+    return ids.at((head - 1 - age + ids.size()) % ids.size());
+}
+
+QVector<quint32> HistoryRing::toVector() const
+{
+    QVector<quint32> result;
+    result.reserve(count);
+    for (int age = count - 1; age >= 0; --age)
+        result.append(at(age));
+    return result;
+}
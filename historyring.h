@@ -0,0 +1,42 @@
+#ifndef HISTORYRING_H
+#define HISTORYRING_H
+
+#include <QVector>
+
+// Fixed-capacity history of file ids, newest last. Once full, every push
+// overwrites the oldest entry. A cursor tracks how far back the user has
+// stepped; all operations are O(1).
+class HistoryRing
+{
+public:
+    explicit HistoryRing(int capacity = 1000);
+
+    // Changing the capacity keeps the newest entries.
+    void setCapacity(int capacity);
+    int capacity() const { return ids.size(); }
+    int size() const { return count; }
+    bool isEmpty() const { return count == 0; }
+    void clear();
+
+    // Add id as the newest entry and move the cursor to it.
+    void push(quint32 id);
+    // Step one entry older or newer. Return false, leaving the cursor
+    // where it is, at either end.
+    bool back(quint32 *id);
+    bool forward(quint32 *id);
+
+    // Entries counted back from the newest: 0 is the newest.
+    int position() const { return cursor; }
+    void setPosition(int age);
+    quint32 at(int age) const;
+    // Oldest first.
+    QVector<quint32> toVector() const;
+
+private:
+    QVector<quint32> ids;
+    int head;   // slot the next push writes to
+    int count;
+    int cursor;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <QAtomicInt>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSet>
+#include <QThread>
+
+#include "downscaler.h"
+#include "imageexporter.h"
+#include "imageloader.h"
+#include "trace.h"
+
+namespace {
+
+// The longest the GUI waits to hear about finished items.
+const int progressIntervalMs = 200;
+
+} // namespace
+
+struct ExportJob
+{
+    ExportJob(ImageExporter *exporter, int generation, const QVector<ImageExporter::Item> &items,
+              const QSize &size, int quality)
+        : exporter(exporter), generation(generation), items(items), size(size), quality(quality)
+        , cancelled(0), next(0), workers(0), notified(false)
+    {
+        stats.total = items.size();
+        stats.written = 0;
+        stats.failed = 0;
+        stats.bytesRead = 0;
+        stats.bytesWritten = 0;
+        stats.elapsedMs = 0;
+        clock.start();
+        sinceNotify.start();
+    }
+
+    // Take the next item, or retire the calling worker.
+    bool take(int *index, bool *last)
+    {
+        QMutexLocker locker(&mutex);
+        if (cancelled.load() || next == items.size()) {
+            *last = --workers == 0;
+            if (*last)
+                stats.elapsedMs = clock.elapsed();
+            return false;
+        }
+        *index = next++;
+        return true;
+    }
+
+    void done(qint64 bytesRead, qint64 bytesWritten, const QString &error)
+    {
+        QMutexLocker locker(&mutex);
+        stats.bytesRead += bytesRead;
+        if (error.isEmpty()) {
+            stats.written++;
+            stats.bytesWritten += bytesWritten;
+        } else {
+            stats.failed++;
+            if (stats.firstError.isEmpty())
+                stats.firstError = error;
+        }
+        if (!notified && sinceNotify.elapsed() >= progressIntervalMs) {
+            notified = true;
+            QMetaObject::invokeMethod(exporter, "onProgress", Qt::QueuedConnection,
+                                      Q_ARG(int, generation));
+        }
+    }
+
+    ImageExporter *exporter;
+    const int generation;
+    const QVector<ImageExporter::Item> items;
+    const QSize size;
+    const int quality;
+    QAtomicInt cancelled;
+    QElapsedTimer clock;
+
+    QMutex mutex;           // guards everything below
+    int next;
+    int workers;            // workers that have not exited yet
+    ImageExporter::Stats stats;
+    bool notified;
+    QElapsedTimer sinceNotify;
+};
+
+namespace {
+
+class ExportWorker : public QRunnable
+{
+public:
+    explicit ExportWorker(const QSharedPointer<ExportJob> &job) : m_job(job) {}
+
+    void run() override
+    {
+        int index;
+        bool last = false;
+        while (m_job->take(&index, &last))
+            write(m_job->items.at(index));
+        // A cancelled job still reports, so the GUI can close its dialog.
+        if (last)
+            QMetaObject::invokeMethod(m_job->exporter, "onFinished", Qt::QueuedConnection,
+                                      Q_ARG(int, m_job->generation));
+    }
+
+private:
+    void write(const ImageExporter::Item &item)
+    {
+        TRACE_SPAN("ImageExporter::write");
+        QImage image = item.image;
+        qint64 bytesRead = 0;
+        if (!item.source.isEmpty()) {
+            // The reader scales while decoding; the fit comes after.
+            const ImageLoader::Frame frame = ImageLoader::decode(item.source, m_job->size);
+            if (frame.image.isNull()) {
+                m_job->done(0, 0, QString("%1: %2").arg(QDir::toNativeSeparators(item.source),
+                                                        frame.errorString));
+                return;
+            }
+            image = frame.image;
+            bytesRead = QFileInfo(item.source).size();
+        }
+        if (m_job->size.isValid()) {
+            const QSize fitted = image.size().scaled(m_job->size, Qt::KeepAspectRatio);
+            // Images are never scaled up. Many of them are written at once,
+            // so each is scaled on its own worker.
+            if (fitted.width() < image.width())
+                image = Downscaler::scale(image, fitted, Downscaler::bestPath(), 1);
+        }
+
+        QSaveFile file(item.target);
+        QImageWriter writer(&file, QFileInfo(item.target).suffix().toLatin1());
+        if (m_job->quality >= 0)
+            writer.setQuality(m_job->quality);
+        QString error;
+        if (!file.open(QIODevice::WriteOnly))
+            error = file.errorString();
+        else if (!writer.write(image))
+            error = writer.errorString();
+        else if (m_job->cancelled.load())
+            return; // not committed, so nothing is left behind
+        else if (!file.commit())
+            error = file.errorString();
+        if (!error.isEmpty())
+            error = QString("%1: %2").arg(QDir::toNativeSeparators(item.target), error);
+        m_job->done(bytesRead, error.isEmpty() ? QFileInfo(item.target).size() : 0, error);
+    }
+
+    QSharedPointer<ExportJob> m_job;
+};
+
+} // namespace
+
+ImageExporter::ImageExporter(QObject *parent)
+    : QObject(parent)
+    , generation(0)
+{
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+ImageExporter::~ImageExporter()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void ImageExporter::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int ImageExporter::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void ImageExporter::start(const QVector<Item> &items, const QSize &size, int quality)
+{
+    cancel();
+    generation++;
+    job = QSharedPointer<ExportJob>(new ExportJob(this, generation, items, size, quality));
+    job->workers = qMin(pool.maxThreadCount(), items.size());
+    for (int i = 0; i < job->workers; ++i)
+        pool.start(new ExportWorker(job));
+    if (job->workers == 0)
+        QMetaObject::invokeMethod(this, "onFinished", Qt::QueuedConnection, Q_ARG(int, generation));
+}
+
+void ImageExporter::cancel()
+{
+    if (job)
+        job->cancelled.store(1);
+}
+
+bool ImageExporter::isRunning() const
+{
+    if (!job)
+        return false;
+    QMutexLocker locker(&job->mutex);
+    return job->workers > 0;
+}
+
+ImageExporter::Stats ImageExporter::stats() const
+{
+    if (!job)
+        return Stats{ 0, 0, 0, 0, 0, 0, QString() };
+    QMutexLocker locker(&job->mutex);
+    Stats stats = job->stats;
+    if (job->workers > 0)
+        stats.elapsedMs = job->clock.elapsed();
+    return stats;
+}
+
+QString ImageExporter::uniqueTarget(const QString &target, QSet<QString> *used)
+{
+    const QFileInfo info(target);
+    QString name = target;
+    for (int n = 2; used->contains(name) || QFileInfo::exists(name); ++n)
+        name = QString("%1/%2-%3.%4").arg(info.path(), info.completeBaseName()).arg(n).arg(info.suffix());
+    used->insert(name);
+    return name;
+}
+
+void ImageExporter::onProgress(int exportGeneration)
+{
+    if (exportGeneration != generation)
+        return;
+    int done;
+    int total;
+    {
+        QMutexLocker locker(&job->mutex);
+        job->notified = false;
+        job->sinceNotify.restart();
+        done = job->stats.written + job->stats.failed;
+        total = job->stats.total;
+    }
+    emit progress(done, total);
+}
+
+void ImageExporter::onFinished(int exportGeneration)
+{
+    if (exportGeneration == generation)
+        emit finished();
+}
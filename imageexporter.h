@@ -0,0 +1,74 @@
+#ifndef IMAGEEXPORTER_H
+#define IMAGEEXPORTER_H
+
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+struct ExportJob;
+
+// Writes images on a pool of worker threads, for Save As and for batch
+// export. Each item is either a file, decoded at full resolution, or an
+// image already in memory; it is scaled to fit a target size if one is
+// given and written in the format of the target's suffix. Files are
+// written through QSaveFile, so a failed or cancelled write never leaves
+// half a file behind. Starting a new job cancels the one in flight.
+class ImageExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Item {
+        QString source;     // file to decode, or empty to write image
+        QImage image;
+        QString target;
+    };
+    struct Stats {
+        int total;
+        int written;
+        int failed;
+        qint64 bytesRead;
+        qint64 bytesWritten;
+        qint64 elapsedMs;
+        QString firstError;
+    };
+
+    explicit ImageExporter(QObject *parent = nullptr);
+    ~ImageExporter();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+
+    // An empty size keeps every image at its full size; quality -1 leaves
+    // it to the writer.
+    void start(const QVector<Item> &items, const QSize &size = QSize(), int quality = -1);
+    void cancel();
+    bool isRunning() const;
+    Stats stats() const;
+
+    // target with its suffix, made unique among used and the files already
+    // on disk by appending -2, -3 and so on, for batches that bring files
+    // of the same name together. Nothing existing is overwritten.
+    static QString uniqueTarget(const QString &target, QSet<QString> *used);
+
+signals:
+    // At most every few hundred milliseconds while the job is running.
+    void progress(int done, int total);
+    void finished();
+
+private slots:
+    void onProgress(int generation);
+    void onFinished(int generation);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<ExportJob> job;
+    int generation;
+};
+
+#endif
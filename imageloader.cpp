@@ -0,0 +1,482 @@
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QRunnable>
+#include <QDebug>
+#include <QtMath>
+
+#include "displaymirror.h"
+#include "downscaler.h"
+#include "fileindex.h"
+#include "imageloader.h"
+#include "mappedfile.h"
+#include "trace.h"
+
+namespace {
+
+class DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(ImageLoader *loader, const QString &fileName, const QSize &targetSize,
+               const QString &mirrorRoot)
+        : m_loader(loader), m_fileName(fileName), m_targetSize(targetSize)
+        , m_mirrorRoot(mirrorRoot) {}
+
+    void run() override
+    {
+        QElapsedTimer timer;
+        timer.start();
+        ImageLoader::Frame frame;
+        if (m_mirrorRoot.isEmpty()
+            || !DisplayMirror::decode(m_mirrorRoot, m_fileName, m_targetSize, &frame)) {
+            // A pick is shown once, so its pages can go again afterwards.
+            frame = ImageLoader::decode(m_fileName, m_targetSize, MappedFile::DropWhenDone);
+        }
+        // The loader waits for the pool in its destructor, so it is still
+        // alive here; the result is handed back on the loader's thread.
+        QMetaObject::invokeMethod(m_loader, "onDecoded", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_fileName),
+                                  Q_ARG(QImage, frame.image),
+                                  Q_ARG(QSize, frame.sourceSize),
+                                  Q_ARG(QString, frame.errorString),
+                                  Q_ARG(qint64, frame.mtime),
+                                  Q_ARG(double, timer.nsecsElapsed() / 1e6));
+    }
+
+private:
+    ImageLoader *m_loader;
+    QString m_fileName;
+    QSize m_targetSize;
+    QString m_mirrorRoot;
+};
+
+class AdviseTask : public QRunnable
+{
+public:
+    explicit AdviseTask(const QString &fileName) : m_fileName(fileName) {}
+
+    void run() override
+    {
+        MappedFile::willNeed(m_fileName);
+    }
+
+private:
+    QString m_fileName;
+};
+
+class RegionTask : public QRunnable
+{
+public:
+    RegionTask(ImageLoader *loader, const QString &fileName, const QRect &rect,
+               const QAtomicInt &latest, int generation)
+        : m_loader(loader), m_fileName(fileName), m_rect(rect)
+        , m_latest(latest), m_generation(generation) {}
+
+    void run() override
+    {
+        // Scrolling on has asked for another region since this one.
+        if (m_latest.load() != m_generation)
+            return;
+        const ImageLoader::Frame frame = ImageLoader::decodeRegion(m_fileName, m_rect);
+        if (m_latest.load() != m_generation)
+            return;
+        // A failure is reported for the rect asked for, so the view can
+        // match it with its request.
+        const QRect clip = m_rect.intersected(QRect(QPoint(0, 0), frame.sourceSize));
+        const QRect rect = frame.image.isNull() ? m_rect : QRect(clip.topLeft(), frame.image.size());
+        QMetaObject::invokeMethod(m_loader, "onRegionDecoded", Qt::QueuedConnection,
+                                  Q_ARG(int, m_generation),
+                                  Q_ARG(QString, m_fileName),
+                                  Q_ARG(QRect, rect),
+                                  Q_ARG(QImage, frame.image),
+                                  Q_ARG(QString, frame.errorString));
+    }
+
+private:
+    ImageLoader *m_loader;
+    QString m_fileName;
+    QRect m_rect;
+    const QAtomicInt &m_latest;
+    const int m_generation;
+};
+
+class SizedTask : public QRunnable
+{
+public:
+    SizedTask(ImageLoader *loader, const QString &fileName, const QSize &targetSize,
+              const QAtomicInt &latest, int generation)
+        : m_loader(loader), m_fileName(fileName), m_targetSize(targetSize)
+        , m_latest(latest), m_generation(generation) {}
+
+    void run() override
+    {
+        if (m_latest.load() != m_generation)
+            return;
+        const ImageLoader::Frame frame = ImageLoader::decode(m_fileName, m_targetSize);
+        if (m_latest.load() != m_generation)
+            return;
+        QMetaObject::invokeMethod(m_loader, "onSizedDecoded", Qt::QueuedConnection,
+                                  Q_ARG(int, m_generation),
+                                  Q_ARG(QString, m_fileName),
+                                  Q_ARG(QSize, m_targetSize),
+                                  Q_ARG(QImage, frame.image),
+                                  Q_ARG(QSize, frame.sourceSize),
+                                  Q_ARG(QString, frame.errorString),
+                                  Q_ARG(qint64, frame.mtime));
+    }
+
+private:
+    ImageLoader *m_loader;
+    QString m_fileName;
+    QSize m_targetSize;
+    const QAtomicInt &m_latest;
+    const int m_generation;
+};
+
+// Map rect of the auto-transformed image back onto the stored one. Qt
+// mirrors, then flips, then rotates by 90 degrees; this undoes it in
+// reverse.
+QRect storedRect(const QRect &rect, QImageIOHandler::Transformations transformation,
+                 const QSize &storedSize)
+{
+    QRect stored = rect;
+    if (transformation & QImageIOHandler::TransformationRotate90)
+        stored = QRect(rect.top(), storedSize.height() - rect.left() - rect.width(),
+                       rect.height(), rect.width());
+    if (transformation & QImageIOHandler::TransformationFlip)
+        stored.moveTop(storedSize.height() - stored.top() - stored.height());
+    if (transformation & QImageIOHandler::TransformationMirror)
+        stored.moveLeft(storedSize.width() - stored.left() - stored.width());
+    return stored;
+}
+
+int costOf(const QImage &image)
+{
+    return int((qint64(image.bytesPerLine()) * image.height() + 1023) / 1024);
+}
+
+} // namespace
+
+ImageLoader::ImageLoader(QObject *parent)
+    : QObject(parent)
+    , cacheHits(0)
+    , cacheMisses(0)
+    , cacheInserts(0)
+    , cacheReplaced(0)
+    , averageDecodeMs(0)
+{
+    pool.setMaxThreadCount(2);
+    setCacheBudget(256);
+}
+
+ImageLoader::~ImageLoader()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+void ImageLoader::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int ImageLoader::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void ImageLoader::setTargetSize(const QSize &size)
+{
+    target = size;
+}
+
+QSize ImageLoader::targetSize() const
+{
+    return target;
+}
+
+void ImageLoader::setMirrorRoot(const QString &root)
+{
+    mirrorRoot = root;
+}
+
+void ImageLoader::request(const QString &fileName, qint64 mtime)
+{
+    if (pending.contains(fileName) || ready.contains(fileName))
+        return;
+    // Not counted as a hit or miss: those are for frames asked for on screen.
+    const Frame *hit = lookup(fileName, mtime, target);
+    if (hit) {
+        ready.insert(fileName, *hit);
+        return;
+    }
+    pending.insert(fileName);
+    // Opening a file can block on a network share, so the readahead hint
+    // goes out from the global pool rather than from here. With a mirror
+    // the file itself is likely not read at all.
+    if (mirrorRoot.isEmpty())
+        QThreadPool::globalInstance()->start(new AdviseTask(fileName));
+    pool.start(new DecodeTask(this, fileName, target, mirrorRoot));
+}
+
+double ImageLoader::decodeMs() const
+{
+    return averageDecodeMs;
+}
+
+bool ImageLoader::isPending(const QString &fileName) const
+{
+    return pending.contains(fileName);
+}
+
+bool ImageLoader::isReady(const QString &fileName) const
+{
+    return ready.contains(fileName);
+}
+
+bool ImageLoader::take(const QString &fileName, Frame *frame)
+{
+    QHash<QString, Frame>::iterator it = ready.find(fileName);
+    if (it == ready.end())
+        return false;
+    *frame = it.value();
+    ready.erase(it);
+    return true;
+}
+
+void ImageLoader::retainOnly(const QSet<QString> &keep)
+{
+    for (QSet<QString>::iterator it = pending.begin(); it != pending.end(); ) {
+        if (keep.contains(*it))
+            ++it;
+        else
+            it = pending.erase(it);
+    }
+    for (QHash<QString, Frame>::iterator it = ready.begin(); it != ready.end(); ) {
+        if (keep.contains(it.key()))
+            ++it;
+        else
+            it = ready.erase(it);
+    }
+}
+
+void ImageLoader::requestRegion(const QString &fileName, const QRect &rect)
+{
+    // The user is looking at it, so it goes ahead of the prefetch.
+    const int generation = regionGeneration.fetchAndAddOrdered(1) + 1;
+    pool.start(new RegionTask(this, fileName, rect, regionGeneration, generation), 1);
+}
+
+void ImageLoader::cancelRegions()
+{
+    regionGeneration.ref();
+}
+
+void ImageLoader::requestSized(const QString &fileName, const QSize &targetSize)
+{
+    const int generation = sizedGeneration.fetchAndAddOrdered(1) + 1;
+    pool.start(new SizedTask(this, fileName, targetSize, sizedGeneration, generation), 1);
+}
+
+void ImageLoader::cancelSized()
+{
+    sizedGeneration.ref();
+}
+
+void ImageLoader::setCacheBudget(int megabytes)
+{
+    cache.setMaxCost(qMax(0, megabytes) * 1024);
+}
+
+const ImageLoader::Frame *ImageLoader::lookup(const QString &fileName, qint64 mtime,
+                                              const QSize &targetSize)
+{
+    const Frame *hit = cache.object(fileName);
+    if (!hit || hit->mtime != mtime)
+        return nullptr;
+    const QSize needed = scaledDecodeSize(hit->sourceSize, targetSize);
+    const bool enough = needed.isValid()
+        ? hit->image.width() >= needed.width()
+        : hit->image.size() == hit->sourceSize;
+    return enough ? hit : nullptr;
+}
+
+bool ImageLoader::cached(const QString &fileName, qint64 mtime, const QSize &targetSize, Frame *frame)
+{
+    const Frame *hit = lookup(fileName, mtime, targetSize);
+    if (!hit) {
+        cacheMisses++;
+        return false;
+    }
+    cacheHits++;
+    *frame = *hit;
+    return true;
+}
+
+void ImageLoader::insertCached(const QString &fileName, const Frame &frame)
+{
+    if (frame.image.isNull())
+        return;
+    if (cache.contains(fileName))
+        cacheReplaced++;
+    cacheInserts++;
+    cache.insert(fileName, new Frame(frame), costOf(frame.image));
+}
+
+ImageLoader::CacheStats ImageLoader::cacheStats() const
+{
+    CacheStats stats;
+    stats.hits = cacheHits;
+    stats.misses = cacheMisses;
+    stats.frames = cache.count();
+    // Everything inserted is either still there, replaced, or evicted.
+    stats.evictions = cacheInserts - cacheReplaced - stats.frames;
+    stats.bytes = qint64(cache.totalCost()) * 1024;
+    return stats;
+}
+
+QSize ImageLoader::scaledDecodeSize(const QSize &sourceSize, const QSize &targetSize)
+{
+    if (sourceSize.isEmpty() || (targetSize.width() <= 0 && targetSize.height() <= 0))
+        return QSize();
+    double factor = 0;
+    if (targetSize.width() > 0)
+        factor = qMax(factor, (double)targetSize.width() / sourceSize.width());
+    if (targetSize.height() > 0)
+        factor = qMax(factor, (double)targetSize.height() / sourceSize.height());
+    if (factor <= 0 || factor >= 1)
+        return QSize();
+    return QSize(qMax(1, qCeil(sourceSize.width() * factor)),
+                 qMax(1, qCeil(sourceSize.height() * factor)));
+}
+
+ImageLoader::Frame ImageLoader::decode(const QString &fileName, const QSize &targetSize,
+                                       MappedFile::Advice advice)
+{
+    TRACE_SPAN("ImageLoader::decode");
+    // Taken before the read, so a file rewritten meanwhile is not cached
+    // as its new version.
+    const qint64 mtime = FileIndex::modificationTime(fileName);
+    MappedFile source(fileName, advice);
+    if (!source.isOpen()) {
+        Frame frame;
+        frame.errorString = source.errorString();
+        return frame;
+    }
+    Frame frame = decode(source.device(), targetSize);
+    frame.mtime = mtime;
+    return frame;
+}
+
+ImageLoader::Frame ImageLoader::decode(QIODevice *device, const QSize &targetSize)
+{
+    Frame frame;
+    QImageReader reader(device);
+    reader.setAutoTransform(true);
+
+    // size() is the stored size; a 90 degree EXIF rotation swaps the target.
+    const QSize storedSize = reader.size();
+    const bool rotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+    const QSize storedTarget = rotated ? targetSize.transposed() : targetSize;
+    const QSize scaledSize = scaledDecodeSize(storedSize, storedTarget);
+    if (scaledSize.isValid())
+        reader.setScaledSize(scaledSize);
+
+    {
+        TRACE_SPAN("reader.read");
+        frame.image = reader.read();
+    }
+    if (frame.image.isNull())
+        frame.errorString = reader.errorString();
+    // Converted here, on the worker, so the GUI thread uploads it as is.
+    frame.image = Downscaler::toDisplayFormat(frame.image);
+    frame.sourceSize = rotated ? storedSize.transposed() : storedSize;
+    if (!frame.sourceSize.isValid())
+        frame.sourceSize = frame.image.size();
+    return frame;
+}
+
+ImageLoader::Frame ImageLoader::decodeRegion(const QString &fileName, const QRect &rect)
+{
+    TRACE_SPAN("ImageLoader::decodeRegion");
+    Frame frame;
+    // Scrolling decodes more regions of the same file; keep it cached.
+    MappedFile source(fileName);
+    if (!source.isOpen()) {
+        frame.errorString = source.errorString();
+        return frame;
+    }
+    QImageReader reader(source.device());
+    reader.setAutoTransform(true);
+    const QSize storedSize = reader.size();
+    const QImageIOHandler::Transformations transformation = reader.transformation();
+    frame.sourceSize = transformation & QImageIOHandler::TransformationRotate90
+        ? storedSize.transposed() : storedSize;
+    const QRect clip = rect.intersected(QRect(QPoint(0, 0), frame.sourceSize));
+    if (clip.isEmpty()) {
+        frame.errorString = reader.canRead() ? QStringLiteral("Region outside the image")
+                                             : reader.errorString();
+        return frame;
+    }
+
+    const bool clipped = reader.supportsOption(QImageIOHandler::ClipRect);
+    if (clipped)
+        reader.setClipRect(storedRect(clip, transformation, storedSize));
+    {
+        TRACE_SPAN("reader.read");
+        frame.image = reader.read();
+    }
+    if (frame.image.isNull())
+        frame.errorString = reader.errorString();
+    else if (!clipped)
+        frame.image = frame.image.copy(clip);
+    frame.image = Downscaler::toDisplayFormat(frame.image);
+    return frame;
+}
+
+void ImageLoader::onRegionDecoded(int generation, const QString &fileName, const QRect &rect,
+                                  const QImage &image, const QString &errorString)
+{
+    // Superseded while the result was on its way here.
+    if (generation != regionGeneration.load())
+        return;
+    if (image.isNull())
+        qDebug() << "Region decode failed for" << fileName << rect << errorString;
+    emit regionReady(fileName, rect, image);
+}
+
+void ImageLoader::onSizedDecoded(int generation, const QString &fileName, const QSize &targetSize,
+                                 const QImage &image, const QSize &sourceSize,
+                                 const QString &errorString, qint64 mtime)
+{
+    if (generation != sizedGeneration.load())
+        return;
+    Frame frame;
+    frame.image = image;
+    frame.sourceSize = sourceSize;
+    frame.errorString = errorString;
+    frame.mtime = mtime;
+    emit sizedReady(fileName, targetSize, frame);
+}
+
+void ImageLoader::onDecoded(const QString &fileName, const QImage &image,
+                            const QSize &sourceSize, const QString &errorString,
+                            qint64 mtime, double decodeMs)
+{
+    // Dropped frames took the pool's time all the same.
+    averageDecodeMs = averageDecodeMs > 0 ? averageDecodeMs + (decodeMs - averageDecodeMs) / 8
+                                          : decodeMs;
+    // A frame that was dropped by retainOnly() while decoding is discarded.
+    if (!pending.remove(fileName))
+        return;
+    if (image.isNull())
+        qDebug() << "Prefetch failed for" << fileName << errorString;
+    Frame frame;
+    frame.image = image;
+    frame.sourceSize = sourceSize;
+    frame.errorString = errorString;
+    frame.mtime = mtime;
+    insertCached(fileName, frame);
+    ready.insert(fileName, frame);
+    emit frameReady(fileName);
+}
@@ -0,0 +1,140 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <QAtomicInt>
+#include <QIODevice>
+#include <QObject>
+#include <QRect>
+#include <QCache>
+#include <QImage>
+#include <QHash>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+#include "mappedfile.h"
+
+// Decodes images on a worker pool so the slideshow timer only has to swap
+// in a frame that is already in memory. Files are read through MappedFile.
+// Decoded frames are also kept in an LRU cache with a byte budget, keyed
+// by path and modification time.
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Frame {
+        QImage image;       // null if the decode failed
+        QSize sourceSize;   // full size of the file, after auto-transform
+        QString errorString;
+        qint64 mtime = -1;  // of the file as decoded, ms since epoch
+    };
+
+    struct CacheStats {
+        int hits;
+        int misses;
+        int evictions;
+        int frames;
+        qint64 bytes;
+    };
+
+    explicit ImageLoader(QObject *parent = nullptr);
+    ~ImageLoader();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+    // Size that prefetched frames are decoded for, see decode().
+    void setTargetSize(const QSize &size);
+    QSize targetSize() const;
+    // Prefetch from the DisplayMirror of root where it is up to date; an
+    // empty root reads the files themselves.
+    void setMirrorRoot(const QString &root);
+
+    // Queue fileName for decoding unless it is already queued or ready.
+    // mtime is the file's modification time as the caller knows it, e.g.
+    // from the FileIndex, so that nothing is stat'ed on this thread.
+    void request(const QString &fileName, qint64 mtime);
+    bool isPending(const QString &fileName) const;
+    bool isReady(const QString &fileName) const;
+    // Moving average of the wall time a prefetch decode takes on a worker,
+    // or 0 before the first one.
+    double decodeMs() const;
+    // Hand over a finished frame. Returns false if the decode has not
+    // completed yet; a failed decode is handed over with a null image.
+    bool take(const QString &fileName, Frame *frame);
+    // Forget every pending and ready frame that is not in keep.
+    void retainOnly(const QSet<QString> &keep);
+    // Decode part of fileName at full resolution, ahead of any prefetch.
+    // The result arrives through regionReady(). Only the latest request
+    // counts: older ones that have not started are dropped, and results
+    // of older ones are thrown away.
+    void requestRegion(const QString &fileName, const QRect &rect);
+    // Drop every region request, e.g. when the image changes.
+    void cancelRegions();
+    // Decode fileName for targetSize, an empty size for full resolution,
+    // ahead of any prefetch, e.g. when zooming in or to print. As with
+    // regions only the latest request counts. The frame arrives through
+    // sizedReady() and is not cached here.
+    void requestSized(const QString &fileName, const QSize &targetSize);
+    void cancelSized();
+
+    void setCacheBudget(int megabytes);
+    // Look fileName up in the frame cache. Only a frame decoded from the
+    // version of the file modified at mtime, with enough pixels for
+    // targetSize, is a hit. Frames carry the mtime their worker read, so
+    // the cache never stat's a file itself.
+    bool cached(const QString &fileName, qint64 mtime, const QSize &targetSize, Frame *frame);
+    void insertCached(const QString &fileName, const Frame &frame);
+    CacheStats cacheStats() const;
+
+    // Decode fileName just large enough to cover targetSize, letting the
+    // reader scale while decoding (DCT scaling for JPEG), and bring it into
+    // a display format, see Downscaler::toDisplayFormat(). A zero width or
+    // height leaves that dimension unconstrained; an empty size decodes at
+    // full resolution. Images are never scaled up. DropWhenDone is for
+    // files read once, like the slideshow's picks; anything decoded again,
+    // at another size or in regions, keeps its pages.
+    static Frame decode(const QString &fileName, const QSize &targetSize = QSize(),
+                        MappedFile::Advice advice = MappedFile::KeepCached);
+    static Frame decode(QIODevice *device, const QSize &targetSize = QSize());
+    static QSize scaledDecodeSize(const QSize &sourceSize, const QSize &targetSize);
+    // Decode only rect of fileName, given in the coordinates of the
+    // auto-transformed image, at full resolution. Readers without clip
+    // rect support decode everything and crop.
+    static Frame decodeRegion(const QString &fileName, const QRect &rect);
+
+signals:
+    void frameReady(const QString &fileName);
+    // rect is where image belongs; image is null if the decode failed.
+    void regionReady(const QString &fileName, const QRect &rect, const QImage &image);
+    void sizedReady(const QString &fileName, const QSize &targetSize, const ImageLoader::Frame &frame);
+
+private slots:
+    void onDecoded(const QString &fileName, const QImage &image, const QSize &sourceSize,
+                   const QString &errorString, qint64 mtime, double decodeMs);
+    void onRegionDecoded(int generation, const QString &fileName, const QRect &rect,
+                         const QImage &image, const QString &errorString);
+    void onSizedDecoded(int generation, const QString &fileName, const QSize &targetSize,
+                        const QImage &image, const QSize &sourceSize,
+                        const QString &errorString, qint64 mtime);
+
+private:
+    const Frame *lookup(const QString &fileName, qint64 mtime, const QSize &targetSize);
+
+    QThreadPool pool;
+    QSize target;
+    QString mirrorRoot;
+    QSet<QString> pending;
+    QHash<QString, Frame> ready;
+    QCache<QString, Frame> cache; // cost in KB
+    int cacheHits;
+    int cacheMisses;
+    int cacheInserts;
+    int cacheReplaced;
+    double averageDecodeMs;
+    QAtomicInt regionGeneration; // of the latest region request
+    QAtomicInt sizedGeneration;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include <QPainter>
+#include <QRegion>
+#include <QResizeEvent>
+
+#include "downscaler.h"
+#include "imageview.h"
+#include "trace.h"
+
+namespace {
+
+// How long the size has to stay put before the smooth pass.
+const int settleMs = 150;
+// Full-resolution regions kept in region mode, newest first.
+const int maxRegions = 4;
+// Failed region decodes retried per image before the preview is left.
+const int maxRegionFailures = 3;
+
+} // namespace
+
+ImageView::ImageView(QWidget *parent)
+    : QWidget(parent)
+    , scaledSmooth(false)
+    , scales(0)
+    , conversions(0)
+    , regionFailures(0)
+{
+    // Every paint covers the whole widget.
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    settleTimer.setSingleShot(true);
+    settleTimer.setInterval(settleMs);
+    connect(&settleTimer, &QTimer::timeout, this, QOverload<>::of(&QWidget::update));
+}
+
+void ImageView::setImage(const QImage &image)
+{
+    source = image;
+    // Decoded frames are converted on the loader's workers; anything else
+    // is converted once here rather than on every rescale and upload.
+    if (!image.isNull() && !Downscaler::isDisplayFormat(image.format())) {
+        source = Downscaler::toDisplayFormat(image);
+        conversions++;
+    }
+    scaled = QPixmap();
+    pyramid.setImage(source);
+    regionSize = QSize();
+    regions.clear();
+    requested = QRect();
+    regionFailures = 0;
+    // A new image is scaled smoothly right away, even mid-resize.
+    settleTimer.stop();
+    updateGeometry();
+    update();
+}
+
+QSize ImageView::sizeHint() const
+{
+    if (isRegionMode())
+        return regionSize;
+    return source.isNull() ? QWidget::sizeHint() : source.size();
+}
+
+void ImageView::setRegionMode(const QSize &fullSize)
+{
+    regionSize = fullSize;
+    regions.clear();
+    requested = QRect();
+    regionFailures = 0;
+    scaled = QPixmap();
+    updateGeometry();
+    update();
+}
+
+void ImageView::addRegion(const QRect &rect, const QImage &image)
+{
+    if (!isRegionMode())
+        return;
+    // Anything else is the answer to a request since replaced, which the
+    // one outstanding still has to cover.
+    if (rect == requested)
+        requested = QRect();
+    Region region;
+    region.rect = rect;
+    region.image = image;
+    regions.prepend(region);
+    while (regions.size() > maxRegions)
+        regions.removeLast();
+    update();
+}
+
+void ImageView::regionFailed(const QRect &rect)
+{
+    if (!isRegionMode() || rect != requested)
+        return;
+    // Past the limit the request stays, so the area keeps the preview
+    // rather than being decoded again on every paint.
+    if (++regionFailures >= maxRegionFailures)
+        return;
+    requested = QRect();
+    update();
+}
+
+QSize ImageView::deviceSize() const
+{
+    return (QSizeF(size()) * devicePixelRatioF()).toSize();
+}
+
+bool ImageView::isTiled() const
+{
+    const QWidget *viewport = parentWidget();
+    return viewport && (width() > viewport->width() || height() > viewport->height());
+}
+
+void ImageView::rescale(Qt::TransformationMode mode)
+{
+    TRACE_SPAN("ImageView::rescale");
+    const QSize target = deviceSize();
+    if (source.isNull() || target.isEmpty()) {
+        scaled = QPixmap();
+        return;
+    }
+    QImage image = source;
+    if (mode == Qt::SmoothTransformation)
+        image = Downscaler::scale(source, target);
+    else if (source.size() != target)
+        image = source.scaled(target, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    {
+        TRACE_SPAN("QPixmap::fromImage");
+        scaled = QPixmap::fromImage(image);
+    }
+    scaled.setDevicePixelRatio(devicePixelRatioF());
+    scaledSmooth = mode == Qt::SmoothTransformation;
+    scales++;
+}
+
+void ImageView::paintEvent(QPaintEvent *event)
+{
+    if (!source.isNull() && isRegionMode()) {
+        scaled = QPixmap();
+        QPainter painter(this);
+        paintRegions(&painter, event->rect());
+        return;
+    }
+    if (!source.isNull() && isTiled()) {
+        scaled = QPixmap();
+        QPainter painter(this);
+        paintTiles(&painter, event->rect());
+        return;
+    }
+
+    const bool resizing = settleTimer.isActive();
+    if (!source.isNull()) {
+        if (scaled.isNull() || scaled.size() != deviceSize())
+            rescale(resizing ? Qt::FastTransformation : Qt::SmoothTransformation);
+        else if (!scaledSmooth && !resizing)
+            rescale(Qt::SmoothTransformation);
+    }
+
+    QPainter painter(this);
+    if (scaled.isNull())
+        painter.fillRect(rect(), palette().brush(backgroundRole()));
+    else
+        painter.drawPixmap(0, 0, scaled);
+}
+
+void ImageView::paintTiles(QPainter *painter, const QRect &exposed)
+{
+    TRACE_SPAN("ImageView::paintTiles");
+    painter->fillRect(exposed, palette().brush(backgroundRole()));
+    const double dpr = devicePixelRatioF();
+    const int level = pyramid.levelFor(qMax(width() * dpr / source.width(),
+                                            height() * dpr / source.height()));
+    // Widget pixels per pixel of the level.
+    const int f = 1 << level;
+    const double kx = double(width()) * f / source.width();
+    const double ky = double(height()) * f / source.height();
+    const QSize levelSize = pyramid.levelSize(level);
+    const int tileSize = TilePyramid::TileSize;
+    const int x0 = qMax(0, int(exposed.left() / kx) / tileSize);
+    const int x1 = qMin((levelSize.width() - 1) / tileSize, int(exposed.right() / kx) / tileSize);
+    const int y0 = qMax(0, int(exposed.top() / ky) / tileSize);
+    const int y1 = qMin((levelSize.height() - 1) / tileSize, int(exposed.bottom() / ky) / tileSize);
+
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            const QRect rect = pyramid.tileRect(level, x, y);
+            // Neighbours round the same edge the same way, so no seams.
+            const QRect target(QPoint(qRound(rect.left() * kx), qRound(rect.top() * ky)),
+                               QPoint(qRound((rect.right() + 1) * kx) - 1,
+                                      qRound((rect.bottom() + 1) * ky) - 1));
+            painter->drawPixmap(target, pyramid.tile(level, x, y));
+        }
+    }
+}
+
+void ImageView::paintRegions(QPainter *painter, const QRect &exposed)
+{
+    TRACE_SPAN("ImageView::paintRegions");
+    // Widget pixels per full-size pixel, 1 unless zoomed away from 1:1.
+    const double kx = double(width()) / regionSize.width();
+    const double ky = double(height()) / regionSize.height();
+    const QRectF previewRect(exposed.x() * source.width() / double(width()),
+                             exposed.y() * source.height() / double(height()),
+                             exposed.width() * source.width() / double(width()),
+                             exposed.height() * source.height() / double(height()));
+    painter->drawImage(QRectF(exposed), source, previewRect);
+    // Oldest first, so the newest ends up on top.
+    for (int i = regions.size() - 1; i >= 0; --i) {
+        const Region &region = regions.at(i);
+        const QRectF target(region.rect.x() * kx, region.rect.y() * ky,
+                            region.rect.width() * kx, region.rect.height() * ky);
+        if (target.intersects(exposed))
+            painter->drawImage(target, region.image);
+    }
+
+    // Ask for what is in view and not covered yet, with half a view of
+    // margin around it so scrolling a little needs no new decode.
+    const QRect full(QPoint(0, 0), regionSize);
+    const QRect shown = visibleRegion().boundingRect();
+    const QRect visible = QRectF(shown.x() / kx, shown.y() / ky, shown.width() / kx, shown.height() / ky)
+        .toAlignedRect().intersected(full);
+    QRegion covered(requested);
+    foreach (const Region &region, regions)
+        covered += region.rect;
+    if (visible.isEmpty() || (QRegion(visible) - covered).isEmpty())
+        return;
+    const int mx = visible.width() / 2;
+    const int my = visible.height() / 2;
+    const QRect wanted = visible.adjusted(-mx, -my, mx, my).intersected(full);
+    requested = (QRegion(wanted) - covered).boundingRect();
+    emit regionNeeded(requested);
+}
+
+void ImageView::resizeEvent(QResizeEvent *event)
+{
+    if (!scaled.isNull() && event->size() != event->oldSize())
+        settleTimer.start();
+    QWidget::resizeEvent(event);
+}
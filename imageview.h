@@ -0,0 +1,86 @@
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include <QImage>
+#include <QList>
+#include <QPixmap>
+#include <QTimer>
+#include <QWidget>
+
+#include "tilepyramid.h"
+
+class QPainter;
+
+// Shows an image stretched over the whole widget, like a QLabel with
+// scaled contents. The scaled copy is cached at device resolution, so a
+// repaint is a plain blit and scaling happens only when the image or the
+// widget's size changes. While the size keeps changing a fast scale is
+// used; a smooth one follows once it has settled.
+//
+// Once the widget grows past the viewport it sits in, as when zoomed in,
+// only the tiles of the exposed area are drawn, from the pyramid level
+// nearest the zoom, so memory no longer grows with the zoom.
+//
+// In region mode the image is a preview of a larger file shown at full
+// size. The preview is stretched as a placeholder, and regionNeeded()
+// asks for the area in view, plus a margin, at full resolution; those
+// regions are drawn over it as they arrive.
+class ImageView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ImageView(QWidget *parent = nullptr);
+
+    void setImage(const QImage &image);
+    QImage image() const { return source; }
+    QSize sizeHint() const override;
+    // Scales done so far, for the stats.
+    int scaleCount() const { return scales; }
+    // Images that arrived in a format QPixmap would have to convert.
+    int conversionCount() const { return conversions; }
+    void setTileCacheBudget(int megabytes) { pyramid.setCacheBudget(megabytes); }
+    const TilePyramid &tiles() const { return pyramid; }
+
+    // Until the next setImage(), with fullSize as the natural size.
+    void setRegionMode(const QSize &fullSize);
+    bool isRegionMode() const { return !regionSize.isEmpty(); }
+    // rect is in full-size pixels.
+    void addRegion(const QRect &rect, const QImage &image);
+    // The decode for rect failed. It is asked for again on the next paint,
+    // up to a few times per image.
+    void regionFailed(const QRect &rect);
+
+signals:
+    void regionNeeded(const QRect &rect);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    QSize deviceSize() const;
+    bool isTiled() const;
+    void rescale(Qt::TransformationMode mode);
+    void paintTiles(QPainter *painter, const QRect &exposed);
+    void paintRegions(QPainter *painter, const QRect &exposed);
+
+    struct Region {
+        QRect rect;
+        QImage image;
+    };
+
+    QImage source;
+    QPixmap scaled;     // source at deviceSize(), with its pixel ratio set
+    bool scaledSmooth;
+    QTimer settleTimer; // running while a resize is in progress
+    int scales;
+    int conversions;
+    TilePyramid pyramid;
+    QSize regionSize;
+    QList<Region> regions; // newest first
+    QRect requested;       // the one request outstanding, if any
+    int regionFailures;    // since the image was set
+};
+
+#endif
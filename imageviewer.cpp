@@ -61,25 +61,97 @@
 
 
 #include "imageviewer.h"
+#include "imageview.h"
+#include "dirwatcher.h"
+#include "displaymirror.h"
+#include "displayscheduler.h"
+#include "exifthumbnail.h"
+#include "headerprober.h"
+#include "imageexporter.h"
+#include "indexscanner.h"
+#include "mappedfile.h"
+#include "skimloader.h"
+#include "thumbnailcache.h"
+#include "thumbnailgrid.h"
+#include "trace.h"
 
 //! [0]
-ImageViewer::ImageViewer()
-   : imageLabel(new QLabel)
+ImageViewer::ImageViewer(const QString &source)
+   : imageView(new ImageView)
    , scrollArea(new QScrollArea)
+   , stack(new QStackedWidget)
+   , thumbnails(new ThumbnailCache(128, this))
+   , grid(new ThumbnailGrid(thumbnails))
    , scaleFactor(1)
+   , scanner(new IndexScanner(this))
+   , streamFileList(false)
+   , watcher(new DirWatcher(this))
+   , prober(new HeaderProber(this))
+   , probedInPass(0)
+   , unreadableInPass(0)
+   , mirror(new DisplayMirror(this))
+   , mirrorPending(false)
+   , indexDirty(false)
+   , rescanTimer(new QTimer(this))
+   , scheduler(new DisplayScheduler(this))
+   , loader(new ImageLoader(this))
+   , waitingId(0)
+   , tickMisses(0)
+   , skimmer(new SkimLoader(this))
+   , skimSettle(new QTimer(this))
+   , skimProxyShown(false)
+   , inputPending(false)
+   , inputFrames(0)
+   , inputLatencySum(0)
+   , inputLatencyMax(0)
+   , fullFrames(0)
+   , fullLatencySum(0)
+   , saver(new ImageExporter(this))
+   , exporter(new ImageExporter(this))
+   , saveProgress(NULL)
+   , exportProgress(NULL)
+   , pendingOutput(NoOutput)
+   , outputProgress(NULL)
 {
     qDebug() << "In ImageViewer";
 
-    imageLabel->setBackgroundRole(QPalette::Base);
-    imageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    imageLabel->setScaledContents(true);
+    imageView->setBackgroundRole(QPalette::Base);
+    imageView->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
 
     scrollArea->setBackgroundRole(QPalette::Dark);
-    scrollArea->setWidget(imageLabel);
-    scrollArea->setVisible(false);
+    scrollArea->setWidget(imageView);
     scrollArea->setWidgetResizable(true);
-    setCentralWidget(scrollArea);
+    stack->addWidget(scrollArea);
+    stack->addWidget(grid);
+    scrollArea->setVisible(false);
+    setCentralWidget(stack);
     createActions();
+    connect(scheduler, &DisplayScheduler::tick, this, &ImageViewer::changeFile);
+    connect(loader, &ImageLoader::frameReady, this, &ImageViewer::frameReady);
+    connect(skimmer, &SkimLoader::frameReady, this, &ImageViewer::skimFrameReady);
+    skimSettle->setSingleShot(true);
+    rescanTimer->setSingleShot(true);
+    connect(rescanTimer, &QTimer::timeout, this, &ImageViewer::rescanFileList);
+    connect(skimSettle, &QTimer::timeout, this, &ImageViewer::skimSettled);
+    connect(loader, &ImageLoader::regionReady, this, &ImageViewer::regionReady);
+    connect(loader, &ImageLoader::sizedReady, this, &ImageViewer::sizedFrameReady);
+    connect(imageView, &ImageView::regionNeeded, this, &ImageViewer::requestRegion);
+    connect(grid, &ThumbnailGrid::activated, this, &ImageViewer::thumbnailActivated);
+    connect(grid, &ThumbnailGrid::closeRequested, this, &ImageViewer::closeBrowse);
+    connect(scanner, &IndexScanner::finished, this, &ImageViewer::fileListScanned);
+    connect(scanner, &IndexScanner::progress, this, &ImageViewer::fileListProgress);
+    connect(prober, &HeaderProber::progress, this, &ImageViewer::headersProbed);
+    connect(prober, &HeaderProber::finished, this, &ImageViewer::headerProbeFinished);
+    connect(watcher, &DirWatcher::fileAdded, this, &ImageViewer::watchedFileAdded);
+    connect(watcher, &DirWatcher::fileRemoved, this, &ImageViewer::watchedFileRemoved);
+    connect(watcher, &DirWatcher::dirAdded, this, &ImageViewer::watchedDirAdded);
+    connect(watcher, &DirWatcher::dirRemoved, this, &ImageViewer::watchedDirRemoved);
+    connect(watcher, &DirWatcher::dirChanged, this, &ImageViewer::watchedDirChanged);
+    connect(watcher, &DirWatcher::overflow, this, &ImageViewer::rescanFileList);
+    connect(saver, &ImageExporter::finished, this, &ImageViewer::saveFinished);
+    connect(exporter, &ImageExporter::progress, this, &ImageViewer::exportProgressed);
+    connect(exporter, &ImageExporter::finished, this, &ImageViewer::exportFinished);
+    saver->setMaxThreads(1);
 
     resize(QGuiApplication::primaryScreen()->availableSize() * 1 / 5);
     showMenu = false;
@@ -88,11 +160,23 @@ ImageViewer::ImageViewer()
     pauseDisplay = false;
     pauseDisplayPerm = false;
     idleCount = 0;
-    prevCount = 0;
     QDateTime now = QDateTime::currentDateTime();
     int l_seed = (now.toMSecsSinceEpoch() % RAND_MAX);
     qsrand(l_seed);
     readSettings();
+    if (!source.isEmpty())
+        sourcepath = source;
+    history.setCapacity(historyDepth);
+    imageView->setTileCacheBudget(tileCacheMB);
+    loader->setMaxThreads(prefetchThreads);
+    loader->setCacheBudget(frameCacheMB);
+    scanner->setMaxThreads(scanThreads);
+    prober->setMaxThreads(probeThreads);
+    mirror->setMaxThreads(mirrorThreads);
+    mirror->setWidth(mirrorWidth);
+    mirror->setReadLimit(mirrorReadMBps);
+    thumbnails->setMaxThreads(thumbnailThreads);
+    thumbnails->setMemoryBudget(thumbnailCacheMB);
     if (! sourcepath.isEmpty()) {
         buildFileList(sourcepath);
         pickFile();
@@ -103,55 +187,140 @@ ImageViewer::ImageViewer()
         statusBar()->show();
         pauseDisplay = true;
     }
-    timer = NULL;
     startDisplayLoop();
 
 }
 
 bool ImageViewer::loadFile(const QString &fileName)
 {
-
-    int pLength = prevList.length();
-    while (pLength > 20) {
-        prevList.removeLast();
-        pLength = prevList.length();
+    TRACE_SPAN("loadFile");
+    // An explicit load wins over a prefetched pick that is still decoding.
+    waitingFor.clear();
+    stopSkim();
+    const QSize target = displayTargetSize();
+    ImageLoader::Frame frame;
+    if (loader->cached(fileName, modificationTime(fileName), target, &frame)) {
+//! [2]
+        showImage(fileName, frame.image, frame.sourceSize);
+        return true;
     }
-  //  for (int x = 0; x<prevList.length();x++){
-  //      qDebug() << "x=" << x << "File=" << prevList[x];
-  //  }
-    currFileName = fileName;
-    QImageReader reader(fileName);
-    reader.setAutoTransform(true);
-    const QImage newImage = reader.read();
-    if (newImage.isNull()) {
+    // The header is enough to turn a file down or to give the window its
+    // new shape, so both happen before the decode.
+    const FileIndex::Meta meta = HeaderProber::probe(fileName);
+    if (meta.state == FileIndex::Unreadable) {
         QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
-                                 tr("Cannot load %1: %2")
-                                 .arg(QDir::toNativeSeparators(fileName), reader.errorString()));
+                                 tr("Cannot load %1: not a readable image")
+                                 .arg(QDir::toNativeSeparators(fileName)));
         return false;
     }
-//! [2]
+    fitWindowTo(HeaderProber::displaySize(meta));
+    openFallbackFile = currFileName;
+    openFallback.image = image;
+    openFallback.sourceSize = imageSourceSize;
+    // Put up the camera's embedded preview while the file decodes; it
+    // only takes the first few KB of the file.
+    const QImage preview = ExifThumbnail::read(fileName);
+    if (!preview.isNull()) {
+        showImage(fileName, preview, HeaderProber::displaySize(meta));
+        imageView->repaint();
+    }
+    // The decode goes to the skim loader, like a step with prev() or
+    // next(), and the frame comes up in skimFrameReady().
+    openFile = fileName;
+    skimFile = fileName;
+    skimProxyShown = false;
+    skimmer->request(fileName, target, false);
+    return true;
+}
 
-    double m_size_factor = (double)((double)this->width() / (double)newImage.width());
-    int new_height = (int) ((double)newImage.height() * m_size_factor);
-    resize(width(),new_height);
+void ImageViewer::showImage(const QString &fileName, const QImage &newImage, const QSize &sourceSize)
+{
+    currFileName = fileName;
+
+    fitWindowTo(newImage.size());
 
-    setImage(newImage);
+    setImage(newImage, sourceSize);
 
     setWindowFilePath(fileName);
 
-    const QString message = tr("Opened \"%1\", %2x%3, Depth: %4")
-        .arg(QDir::toNativeSeparators(fileName)).arg(image.width()).arg(image.height()).arg(image.depth());
+    if (inputPending) {
+        // The frame answers a key press: paint it now and count the wait.
+        imageView->repaint();
+        inputPending = false;
+        const double ms = lastInput.nsecsElapsed() / 1e6;
+        inputFrames++;
+        inputLatencySum += ms;
+        inputLatencyMax = qMax(inputLatencyMax, ms);
+    }
+
+    const QString message = tr("Opened \"%1\", %2x%3 (decoded %4x%5), Depth: %6")
+        .arg(QDir::toNativeSeparators(fileName))
+        .arg(imageSourceSize.width()).arg(imageSourceSize.height())
+        .arg(image.width()).arg(image.height()).arg(image.depth());
     statusBar()->showMessage(message);
+}
 
-    return true;
+// Keep the window width and take the height from the image's aspect ratio.
+void ImageViewer::fitWindowTo(const QSize &imageSize)
+{
+    if (imageSize.isEmpty())
+        return;
+    double m_size_factor = (double)((double)this->width() / (double)imageSize.width());
+    int new_height = (int) ((double)imageSize.height() * m_size_factor);
+    TRACE_SPAN("resize");
+    resize(width(),new_height);
+}
+
+// Decode just enough pixels to fill the window width; the height follows
+// from the aspect ratio when the window is resized to the image.
+QSize ImageViewer::displayTargetSize() const
+{
+    return QSize(qRound(width() * devicePixelRatioF()), 0);
 }
 
-void ImageViewer::setImage(const QImage &newImage)
+// The frame cache's version check. Indexed files are looked up in the
+// index, so only a file opened from elsewhere is stat'ed.
+qint64 ImageViewer::modificationTime(const QString &fileName) const
 {
+    const qint64 id = fileIndex.findFile(fileName);
+    return id >= 0 ? fileIndex.fileAt(quint32(id)).mtime : FileIndex::modificationTime(fileName);
+}
+
+// Re-decode the current file when the view needs more pixels than the
+// display-sized decode holds.
+void ImageViewer::ensureResolution(const QSize &needed)
+{
+    if (currFileName.isEmpty() || image.width() >= qMin(needed.width(), imageSourceSize.width()))
+        return;
+    ImageLoader::Frame frame;
+    if (!loader->cached(currFileName, modificationTime(currFileName), needed, &frame)) {
+        // The frame up stays stretched until sizedFrameReady().
+        if (pendingOutput == NoOutput)
+            loader->requestSized(currFileName, needed);
+        return;
+    }
+    image = frame.image;
+    imageView->setImage(image);
+    loader->cancelRegions();
+}
+
+void ImageViewer::setImage(const QImage &newImage, const QSize &sourceSize)
+{
+    TRACE_SPAN("setImage");
     image = newImage;
-    imageLabel->setPixmap(QPixmap::fromImage(image));
+    imageSourceSize = sourceSize.isValid() ? sourceSize : newImage.size();
+    baseSize = image.size();
+    // Scaled to the view and uploaded on the next paint.
+    imageView->setImage(image);
+    loader->cancelRegions();
 //! [4]
     scaleFactor = 1.0;
+    // A new image starts out fitted again.
+    if (!fitToWindowAct->isChecked()) {
+        fitToWindowAct->setChecked(true);
+        scrollArea->setWidgetResizable(true);
+        updateActions();
+    }
 
     scrollArea->setVisible(true);
 //    printAct->setEnabled(true);
@@ -159,24 +328,160 @@ void ImageViewer::setImage(const QImage &newImage)
 //    updateActions();
 
 //    if (!fitToWindowAct->isChecked())
-//        imageLabel->adjustSize();
+//        imageView->adjustSize();
 }
 
 //! [4]
 
-bool ImageViewer::saveFile(const QString &fileName)
+// The shown image is only decoded for the window, so a file is decoded
+// again at full resolution. Both happen on a worker; saveFinished() reports.
+void ImageViewer::saveFile(const QString &fileName)
 {
-    QImageWriter writer(fileName);
+    ImageExporter::Item item;
+    item.source = windowFilePath();
+    if (item.source.isEmpty())
+        item.image = image;
+    item.target = fileName;
+    saveTarget = fileName;
+    saver->start(QVector<ImageExporter::Item>() << item);
+    statusBar()->showMessage(tr("Writing \"%1\"...").arg(QDir::toNativeSeparators(fileName)));
+
+    delete saveProgress;
+    saveProgress = new QProgressDialog(tr("Writing %1...").arg(QDir::toNativeSeparators(fileName)),
+                                       tr("Cancel"), 0, 0, this);
+    saveProgress->setMinimumDuration(500);
+    connect(saveProgress, &QProgressDialog::canceled, saver, &ImageExporter::cancel);
+}
 
-    if (!writer.write(image)) {
+void ImageViewer::saveFinished()
+{
+    if (saveProgress) {
+        saveProgress->deleteLater();
+        saveProgress = NULL;
+    }
+    const ImageExporter::Stats stats = saver->stats();
+    if (stats.failed > 0) {
         QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
-                                 tr("Cannot write %1: %2")
-                                 .arg(QDir::toNativeSeparators(fileName)), writer.errorString());
-        return false;
+                                 tr("Cannot write %1").arg(stats.firstError));
+    } else if (stats.written > 0) {
+        statusBar()->showMessage(tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(saveTarget)));
+    } else {
+        statusBar()->showMessage(tr("Save cancelled"));
     }
-    const QString message = tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(fileName));
-    statusBar()->showMessage(message);
-    return true;
+}
+
+// Writes the files of the history, or of a folder and its subfolders, to
+// one folder at a chosen size and format.
+void ImageViewer::exportImages()
+{
+    if (exporter->isRunning()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("An export is still running."));
+        return;
+    }
+    const QStringList choices = QStringList()
+        << tr("History (%1 images)").arg(history.size()) << tr("A folder...");
+    bool ok = false;
+    const QString choice = QInputDialog::getItem(this, tr("Export"), tr("Export:"), choices, 0, false, &ok);
+    if (!ok)
+        return;
+    QStringList sources;
+    if (choice == choices.first()) {
+        foreach (quint32 id, history.toVector()) {
+            if (id < fileIndex.idCount() && fileIndex.isLive(id))
+                sources.append(fileIndex.filePath(id));
+        }
+        sources.removeDuplicates();
+    } else {
+        const QString dir = QFileDialog::getExistingDirectory(this, tr("Export Folder"), sourcepath);
+        if (dir.isEmpty())
+            return;
+        if (fileIndex.findDir(dir) < 0) {
+            QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                     tr("%1 is not part of the slideshow.")
+                                     .arg(QDir::toNativeSeparators(dir)));
+            return;
+        }
+        // The index already holds the tree, so nothing is listed here.
+        const QString prefix = dir + QLatin1Char('/');
+        for (int d = 0; d < fileIndex.dirCount(); ++d) {
+            const QString path = fileIndex.dirAt(d).path;
+            if (path != dir && !path.startsWith(prefix))
+                continue;
+            foreach (const FileIndex::File &file, fileIndex.filesOf(d))
+                sources.append(path + QLatin1Char('/') + file.name);
+        }
+    }
+    if (sources.isEmpty()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(), tr("Nothing to export."));
+        return;
+    }
+
+    const QString targetDir = QFileDialog::getExistingDirectory(this, tr("Export To"));
+    if (targetDir.isEmpty())
+        return;
+    const QString size = QInputDialog::getText(this, tr("Export"), tr("Size as WxH, empty for full size:"),
+                                               QLineEdit::Normal, exportSize, &ok).trimmed();
+    if (!ok)
+        return;
+    const QStringList sides = size.split(QLatin1Char('x'));
+    const QSize targetSize = sides.size() == 2 ? QSize(sides.at(0).toInt(), sides.at(1).toInt()) : QSize();
+    if (!size.isEmpty() && targetSize.isEmpty()) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("%1 is not a size like 1920x1080.").arg(size));
+        return;
+    }
+    QStringList formats;
+    foreach (const QByteArray &format, QImageWriter::supportedImageFormats())
+        formats.append(QString::fromLatin1(format));
+    const QString format = QInputDialog::getItem(this, tr("Export"), tr("Format:"), formats,
+                                                 qMax(0, formats.indexOf(exportFormat)), false, &ok);
+    if (!ok)
+        return;
+    exportSize = size;
+    exportFormat = format;
+
+    QVector<ImageExporter::Item> items;
+    QSet<QString> used;
+    foreach (const QString &source, sources) {
+        ImageExporter::Item item;
+        item.source = source;
+        item.target = ImageExporter::uniqueTarget(targetDir + QLatin1Char('/') + QFileInfo(source).completeBaseName()
+                                                  + QLatin1Char('.') + format, &used);
+        items.append(item);
+    }
+    exporter->start(items, targetSize, exportQuality);
+
+    delete exportProgress;
+    exportProgress = new QProgressDialog(tr("Exporting %1 images...").arg(items.size()), tr("Cancel"),
+                                         0, items.size(), this);
+    exportProgress->setMinimumDuration(500);
+    connect(exportProgress, &QProgressDialog::canceled, exporter, &ImageExporter::cancel);
+}
+
+void ImageViewer::exportProgressed(int done, int total)
+{
+    Q_UNUSED(total);
+    if (exportProgress)
+        exportProgress->setValue(done);
+}
+
+void ImageViewer::exportFinished()
+{
+    if (exportProgress) {
+        exportProgress->deleteLater();
+        exportProgress = NULL;
+    }
+    const ImageExporter::Stats stats = exporter->stats();
+    const double seconds = qMax<qint64>(1, stats.elapsedMs) / 1000.0;
+    QString message = tr("Exported %1 of %2 images in %3 s: %4 images/s, %5 MB/s read, %6 MB/s written.")
+        .arg(stats.written).arg(stats.total).arg(seconds, 0, 'f', 1)
+        .arg(stats.written / seconds, 0, 'f', 1)
+        .arg(stats.bytesRead / (1024.0 * 1024.0) / seconds, 0, 'f', 1)
+        .arg(stats.bytesWritten / (1024.0 * 1024.0) / seconds, 0, 'f', 1);
+    if (stats.failed > 0)
+        message += QLatin1Char('\n') + tr("%1 failed, the first with %2").arg(stats.failed).arg(stats.firstError);
+    QMessageBox::information(this, QGuiApplication::applicationDisplayName(), message);
 }
 
 //! [1]
@@ -206,11 +511,14 @@ static void initializeImageFileDialog(QFileDialog &dialog, QFileDialog::AcceptMo
 void ImageViewer::openDir()
 {
     qDebug() << "In openDir" << endl;
-    sourcepath = QFileDialog::getExistingDirectory(this, tr("Open Directory"),
+    const QString dir = QFileDialog::getExistingDirectory(this, tr("Open Directory"),
                                                  ".",
                                                  QFileDialog::ShowDirsOnly
                                                  | QFileDialog::DontResolveSymlinks);
-    qDebug() << "Got" << sourcepath << endl;
+    qDebug() << "Got" << dir << endl;
+    if (dir.isEmpty())
+        return;
+    sourcepath = dir;
     buildFileList(sourcepath);
     //QFileDialog dialog(this, tr("Open File"));
     //initializeImageFileDialog(dialog, QFileDialog::AcceptOpen);
@@ -233,27 +541,66 @@ void ImageViewer::saveAs()
     QFileDialog dialog(this, tr("Save File As"));
     initializeImageFileDialog(dialog, QFileDialog::AcceptSave);
 
-    while (dialog.exec() == QDialog::Accepted && !saveFile(dialog.selectedFiles().first())) {}
+    if (dialog.exec() == QDialog::Accepted)
+        saveFile(dialog.selectedFiles().first());
+}
+
+void ImageViewer::saveTrace()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, tr("Save Trace"),
+                                                          "imageviewer-trace.json",
+                                                          tr("Chrome trace (*.json)"));
+    if (fileName.isEmpty())
+        return;
+    if (!Trace::save(fileName)) {
+        QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                                 tr("Cannot write %1").arg(QDir::toNativeSeparators(fileName)));
+        return;
+    }
+    statusBar()->showMessage(tr("Wrote trace to \"%1\"").arg(QDir::toNativeSeparators(fileName)));
 }
 
 //! [5]
+void ImageViewer::browse()
+{
+    if (!browseAct->isChecked()) {
+        stack->setCurrentWidget(scrollArea);
+        return;
+    }
+    // Browsing holds the slideshow, like pause().
+    pause();
+    grid->setFiles(fileIndex);
+    if (!currFileName.isEmpty())
+        grid->setCurrent(currFileName);
+    stack->setCurrentWidget(grid);
+    grid->setFocus();
+    statusBar()->showMessage(tr("%1 images").arg(grid->count()));
+}
+
+void ImageViewer::closeBrowse()
+{
+    browseAct->setChecked(false);
+    browse();
+}
+
+void ImageViewer::thumbnailActivated(const QString &fileName)
+{
+    closeBrowse();
+    const qint64 id = fileIndex.findFile(fileName);
+    if (loadFile(fileName) && id >= 0)
+        history.push(quint32(id));
+}
+
 void ImageViewer::print()
 //! [5] //! [6]
 {
-    Q_ASSERT(imageLabel->pixmap());
+    Q_ASSERT(!image.isNull());
 #if !defined(QT_NO_PRINTER) && !defined(QT_NO_PRINTDIALOG)
 //! [6] //! [7]
     QPrintDialog dialog(&printer, this);
 //! [7] //! [8]
-    if (dialog.exec()) {
-        QPainter painter(&printer);
-        QRect rect = painter.viewport();
-        QSize size = imageLabel->pixmap()->size();
-        size.scale(rect.size(), Qt::KeepAspectRatio);
-        painter.setViewport(rect.x(), rect.y(), size.width(), size.height());
-        painter.setWindow(imageLabel->pixmap()->rect());
-        painter.drawPixmap(0, 0, *imageLabel->pixmap());
-    }
+    if (dialog.exec())
+        requestFullImage(PrintOutput);
 #endif
 }
 //! [8]
@@ -261,10 +608,85 @@ void ImageViewer::print()
 void ImageViewer::copy()
 {
 #ifndef QT_NO_CLIPBOARD
-    QGuiApplication::clipboard()->setImage(image);
+    requestFullImage(CopyOutput);
 #endif // !QT_NO_CLIPBOARD
 }
 
+// The shown image is only decoded for the window; print and copy want the
+// file at full resolution, so it is decoded again on the loader, behind a
+// progress dialog as in saveFile(). useFullImage() finishes the job.
+void ImageViewer::requestFullImage(Output output)
+{
+    const QString fileName = windowFilePath();
+    if (fileName.isEmpty() || image.size() == imageSourceSize) {
+        useFullImage(output, image);
+        return;
+    }
+    pendingOutput = output;
+    loader->requestSized(fileName, QSize());
+    delete outputProgress;
+    outputProgress = new QProgressDialog(tr("Decoding %1...").arg(QDir::toNativeSeparators(fileName)),
+                                         tr("Cancel"), 0, 0, this);
+    outputProgress->setMinimumDuration(500);
+    connect(outputProgress, &QProgressDialog::canceled, this, &ImageViewer::cancelFullImage);
+}
+
+void ImageViewer::cancelFullImage()
+{
+    pendingOutput = NoOutput;
+    loader->cancelSized();
+    if (outputProgress) {
+        outputProgress->deleteLater();
+        outputProgress = NULL;
+    }
+}
+
+void ImageViewer::useFullImage(Output output, const QImage &page)
+{
+    if (output == CopyOutput) {
+#ifndef QT_NO_CLIPBOARD
+        QGuiApplication::clipboard()->setImage(page);
+#endif
+    } else if (output == PrintOutput) {
+#if !defined(QT_NO_PRINTER) && !defined(QT_NO_PRINTDIALOG)
+        QPainter painter(&printer);
+        QRect rect = painter.viewport();
+        QSize size = page.size();
+        size.scale(rect.size(), Qt::KeepAspectRatio);
+        painter.setViewport(rect.x(), rect.y(), size.width(), size.height());
+        painter.setWindow(page.rect());
+        painter.drawImage(0, 0, page);
+#endif
+    }
+}
+
+// A full-resolution decode for print or copy, or a larger frame for the
+// zoom ensureResolution() asked for.
+void ImageViewer::sizedFrameReady(const QString &fileName, const QSize &targetSize,
+                                  const ImageLoader::Frame &frame)
+{
+    if (pendingOutput != NoOutput && targetSize.isEmpty()) {
+        const Output output = pendingOutput;
+        cancelFullImage();
+        if (frame.image.isNull()) {
+            // The frame up is better than nothing.
+            statusBar()->showMessage(tr("Cannot decode %1 at full size: %2")
+                                     .arg(QDir::toNativeSeparators(fileName), frame.errorString));
+            useFullImage(output, image);
+        } else {
+            useFullImage(output, frame.image);
+        }
+        return;
+    }
+    if (fileName != currFileName || frame.image.isNull() || imageView->isRegionMode()
+        || frame.image.width() <= image.width())
+        return;
+    loader->insertCached(fileName, frame);
+    image = frame.image;
+    imageView->setImage(image);
+    loader->cancelRegions();
+}
+
 #ifndef QT_NO_CLIPBOARD
 static QImage clipboardImage()
 {
@@ -311,9 +733,51 @@ void ImageViewer::zoomOut()
 void ImageViewer::normalSize()
 //! [11] //! [12]
 {
-    imageLabel->adjustSize();
+    leaveFitToWindow();
+    ImageLoader::Frame frame;
+    if (image.size() == imageSourceSize || currFileName.isEmpty()
+        || loader->cached(currFileName, modificationTime(currFileName), imageSourceSize, &frame)) {
+        ensureResolution(imageSourceSize);
+        baseSize = image.size();
+    } else {
+        // Decoding all of a large file would stall here. Stretch the frame
+        // we have and decode only what scrolls into view.
+        imageView->setRegionMode(imageSourceSize);
+        baseSize = imageSourceSize;
+    }
+    imageView->adjustSize();
     scaleFactor = 1.0;
 }
+
+void ImageViewer::requestRegion(const QRect &rect)
+{
+    if (!currFileName.isEmpty())
+        loader->requestRegion(currFileName, rect);
+}
+
+void ImageViewer::regionReady(const QString &fileName, const QRect &rect, const QImage &region)
+{
+    if (fileName != currFileName)
+        return;
+    if (region.isNull())
+        imageView->regionFailed(rect);
+    else
+        imageView->addRegion(rect, region);
+}
+
+// Zooming and 1:1 size the view themselves; the scroll area stops
+// resizing it. Zoom factors then start from the fitted size.
+void ImageViewer::leaveFitToWindow()
+{
+    if (!fitToWindowAct->isChecked())
+        return;
+    baseSize = imageView->size();
+    scaleFactor = 1.0;
+    fitToWindowAct->setChecked(false);
+    scrollArea->setWidgetResizable(false);
+    imageView->resize(baseSize);
+    updateActions();
+}
 //! [12]
 
 //! [13]
@@ -437,6 +901,16 @@ void ImageViewer::createActions()
     openDirAct->setStatusTip(tr("Open source folder of images"));
     connect(openDirAct, &QAction::triggered, this, &ImageViewer::openDir);
 
+    saveAsAct = menuBar()->addAction(tr("&Save As"));
+    saveAsAct->setShortcut(tr("Ctrl+S"));
+    saveAsAct->setStatusTip(tr("Save the image at full resolution"));
+    connect(saveAsAct, &QAction::triggered, this, &ImageViewer::saveAs);
+
+    exportAct = menuBar()->addAction(tr("E&xport"));
+    exportAct->setShortcut(tr("Ctrl+Shift+S"));
+    exportAct->setStatusTip(tr("Export the history or a folder at another size or format"));
+    connect(exportAct, &QAction::triggered, this, &ImageViewer::exportImages);
+
     prevAct = menuBar()->addAction(tr("&Prev"));
     prevAct->setShortcut(tr("Ctrl+P"));
     prevAct->setStatusTip(tr("Show previous image"));
@@ -473,17 +947,54 @@ void ImageViewer::createActions()
     connect(exploreAct, &QAction::triggered, this, &ImageViewer::openFolderInExplorer);
 
     decreaseAct = menuBar()->addAction(tr("Dec"));
-    decreaseAct->setStatusTip(tr("Decrease time delay by 1 second"));
+    decreaseAct->setStatusTip(tr("Decrease time delay by 1 second, or halve it below 1 second"));
     connect(decreaseAct, &QAction::triggered, this, &ImageViewer::decreaseDelay);
 
     increaseAct = menuBar()->addAction(tr("Inc"));
-    increaseAct->setStatusTip(tr("Increase time delay by 1 second"));
+    increaseAct->setStatusTip(tr("Increase time delay by 1 second, or double it below 1 second"));
     connect(increaseAct, &QAction::triggered, this, &ImageViewer::increaseDelay);
 
     setDelayAct = menuBar()->addAction(tr("Set Delay"));
     setDelayAct->setStatusTip(tr("Directly set the time delay"));
     connect(setDelayAct, &QAction::triggered, this, &ImageViewer::setDelay);
 
+    statsAct = menuBar()->addAction(tr("Stats"));
+    statsAct->setStatusTip(tr("Show slideshow statistics"));
+    connect(statsAct, &QAction::triggered, this, &ImageViewer::showStats);
+
+    zoomInAct = menuBar()->addAction(tr("Zoom+"));
+    zoomInAct->setShortcut(QKeySequence::ZoomIn);
+    zoomInAct->setStatusTip(tr("Zoom in by 25%"));
+    connect(zoomInAct, &QAction::triggered, this, &ImageViewer::zoomIn);
+
+    zoomOutAct = menuBar()->addAction(tr("Zoom-"));
+    zoomOutAct->setShortcut(QKeySequence::ZoomOut);
+    zoomOutAct->setStatusTip(tr("Zoom out by 20%"));
+    connect(zoomOutAct, &QAction::triggered, this, &ImageViewer::zoomOut);
+
+    normalSizeAct = menuBar()->addAction(tr("1:1"));
+    normalSizeAct->setShortcut(tr("Ctrl+0"));
+    normalSizeAct->setStatusTip(tr("Show the image at its full resolution"));
+    connect(normalSizeAct, &QAction::triggered, this, &ImageViewer::normalSize);
+
+    fitToWindowAct = menuBar()->addAction(tr("Fit"));
+    fitToWindowAct->setShortcut(tr("Ctrl+F"));
+    fitToWindowAct->setStatusTip(tr("Fit the image to the window"));
+    fitToWindowAct->setCheckable(true);
+    fitToWindowAct->setChecked(true);
+    connect(fitToWindowAct, &QAction::triggered, this, &ImageViewer::fitToWindow);
+
+    traceAct = menuBar()->addAction(tr("Trace"));
+    traceAct->setStatusTip(tr("Save recent timing spans as a Chrome trace"));
+    traceAct->setVisible(Trace::isCompiledIn());
+    connect(traceAct, &QAction::triggered, this, &ImageViewer::saveTrace);
+
+    browseAct = menuBar()->addAction(tr("&Browse"));
+    browseAct->setShortcut(tr("Ctrl+B"));
+    browseAct->setStatusTip(tr("Browse the images as thumbnails"));
+    browseAct->setCheckable(true);
+    connect(browseAct, &QAction::triggered, this, &ImageViewer::browse);
+
     quitAct = menuBar()->addAction(tr("&Quit"));
     quitAct->setShortcut(tr("Ctrl-Q"));
     quitAct->setStatusTip(tr("Quit"));
@@ -501,9 +1012,10 @@ void ImageViewer::updateActions()
 {
 //    saveAsAct->setEnabled(!image.isNull());
 //    copyAct->setEnabled(!image.isNull());
-//    zoomInAct->setEnabled(!fitToWindowAct->isChecked());
-//    zoomOutAct->setEnabled(!fitToWindowAct->isChecked());
-//    normalSizeAct->setEnabled(!fitToWindowAct->isChecked());
+    if (fitToWindowAct->isChecked()) {
+        zoomInAct->setEnabled(true);
+        zoomOutAct->setEnabled(true);
+    }
 }
 //! [22]
 
@@ -511,9 +1023,16 @@ void ImageViewer::updateActions()
 void ImageViewer::scaleImage(double factor)
 //! [23] //! [24]
 {
-    Q_ASSERT(imageLabel->pixmap());
+    if (image.isNull())
+        return;
+    leaveFitToWindow();
     scaleFactor *= factor;
-    imageLabel->resize(scaleFactor * imageLabel->pixmap()->size());
+    const QSize newSize = scaleFactor * baseSize;
+    // In region mode the view asks for the regions it shows at any zoom;
+    // decoding the whole file here would stall on a large scan.
+    if (!imageView->isRegionMode())
+        ensureResolution(newSize);
+    imageView->resize(newSize);
 
     adjustScrollBar(scrollArea->horizontalScrollBar(), factor);
     adjustScrollBar(scrollArea->verticalScrollBar(), factor);
@@ -532,28 +1051,352 @@ void ImageViewer::adjustScrollBar(QScrollBar *scrollBar, double factor)
 }
 //! [26]
 void ImageViewer::buildFileList(const QString &sourcepath){
+    TRACE_SPAN("buildFileList");
     qDebug() << "In buildFileList with" << sourcepath;
-    qDebug() << "fileList len before =" << fileList.length();
+    const QString pattern = QStringLiteral("*.jpg");
+
+    // Start from the saved index so the slideshow can begin right away,
+    // then revalidate it in the background.
+    FileIndex saved;
+    if (saved.load(FileIndex::defaultLocation())
+        && saved.root() == sourcepath && saved.pattern() == pattern) {
+        fileIndex = saved;
+    } else {
+        fileIndex = FileIndex();
+    }
+    // Ids of another tree mean nothing here.
+    history.clear();
+    pickQueue.clear();
+    batchPicks.clear();
+    const FileIndex::ShufflePass pass = fileIndex.shufflePass();
+    shuffle.reset(pass.count, pass.seed, pass.position);
+    waitingFor.clear();
+    qDebug() << "fileIndex len from disk =" << fileIndex.fileCount();
+    // Without a saved index, the slideshow starts on the first batches.
+    streamFileList = fileIndex.isEmpty();
+    if (streamFileList)
+        fileIndex.setRoot(sourcepath, pattern);
+    watcher->unwatchAll();
+    mirror->cancel();
+    mirrorPending = false;
+    loader->setMirrorRoot(mirrorWidth > 0 ? sourcepath : QString());
+    skimmer->setMirrorRoot(mirrorWidth > 0 ? sourcepath : QString());
+    scanner->start(sourcepath, pattern, fileIndex);
+    // A streamed index is probed once the scan has finished.
+    if (streamFileList)
+        prober->cancel();
+    else
+        startHeaderProbe();
+}
 
-    findRecursion(sourcepath, QStringLiteral("*.jpg"), &fileList);
-    qDebug() << "fileList len after =" << fileList.length();
-    //loadFile(fileList.at(3));
+void ImageViewer::fileListProgress()
+{
+    const QVector<FileIndex::DirEntries> batch = scanner->takeBatch();
+    if (streamFileList) {
+        // Batches arrive in scan order, so parent indices line up.
+        foreach (const FileIndex::DirEntries &dir, batch)
+            fileIndex.appendDir(dir.path, dir.mtime, dir.parent, dir.files);
+        if (currFileName.isEmpty() && waitingFor.isEmpty() && !pauseDisplay && !pauseDisplayPerm)
+            pickFile();
+    }
+    const FileIndex::ScanStats stats = scanner->stats();
+    statusBar()->showMessage(tr("Scanning: %1 files in %2 folders, %3 files/s")
+                             .arg(stats.files).arg(stats.dirsListed + stats.dirsReused)
+                             .arg(qRound(stats.files * 1000.0 / qMax<qint64>(1, stats.elapsedMs))));
 }
 
-void ImageViewer::findRecursion(const QString &path, const QString &pattern, QStringList *result)
+void ImageViewer::fileListScanned()
 {
-    QDir currentDir(path);
-    const QString prefix = path + QLatin1Char('/');
-    foreach (const QString &match, currentDir.entryList(QStringList(pattern), QDir::Files | QDir::NoSymLinks))
-        result->append(prefix + match);
-    foreach (const QString &sourcepath, currentDir.entryList(QDir::Dirs | QDir::NoSymLinks | QDir::NoDotAndDotDot))
-        findRecursion(prefix + sourcepath, pattern, result);
+    adoptIndex(scanner->result());
+    const FileIndex::ScanStats stats = scanner->stats();
+    qDebug() << "fileIndex len after scan =" << fileIndex.fileCount()
+             << "dirs listed" << stats.dirsListed << "reused" << stats.dirsReused
+             << "in" << stats.elapsedMs << "ms";
+    statusBar()->showMessage(tr("Scanned %1 files in %2 folders in %3 s, %4 files/s")
+                             .arg(stats.files).arg(stats.dirsListed + stats.dirsReused)
+                             .arg(stats.elapsedMs / 1000.0, 0, 'f', 1)
+                             .arg(qRound(stats.files * 1000.0 / qMax<qint64>(1, stats.elapsedMs))));
+    streamFileList = false;
+    startHeaderProbe();
+    // Copies are made once the headers are in, so unreadable files are
+    // skipped and the two passes do not compete for the source.
+    mirrorPending = mirrorWidth > 0;
+    if (!prober->isRunning())
+        startMirror();
+    if (!fileIndex.save(FileIndex::defaultLocation()))
+        qDebug() << "Cannot write index" << FileIndex::defaultLocation();
+    indexDirty = false;
+    qDebug() << "fileIndex uses" << fileIndex.memoryUsage() << "bytes,"
+             << fileIndex.bytesPerFile() << "per file";
+
+    // From here on the list is kept current by the watcher.
+    QStringList dirs;
+    for (int i = 0; i < fileIndex.dirCount(); ++i)
+        dirs.append(fileIndex.dirAt(i).path);
+    watcher->unwatchAll();
+    watcher->watch(dirs);
+    // One timer, restarted by every scan, so rescans never pile up.
+    if (watcher->unwatchedCount() > 0) {
+        qDebug() << watcher->unwatchedCount() << "folders not watched, rescanning in"
+                 << rescanMinutes << "minutes";
+        rescanTimer->start(rescanMinutes * 60 * 1000);
+    } else {
+        rescanTimer->stop();
+    }
+
+    if (currFileName.isEmpty() && waitingFor.isEmpty() && !pauseDisplay && !pauseDisplayPerm)
+        pickFile();
+}
+
+// Probe every file whose header has not been read yet. Results refer to
+// the ids of fileIndex, so a replaced index needs a new probe.
+void ImageViewer::startHeaderProbe()
+{
+    QVector<quint32> ids;
+    for (quint32 id = 0; id < fileIndex.idCount(); ++id) {
+        if (fileIndex.isLive(id) && fileIndex.metaAt(id).state == FileIndex::Unprobed)
+            ids.append(id);
+    }
+    qDebug() << "Probing" << ids.size() << "file headers";
+    probedInPass = 0;
+    unreadableInPass = 0;
+    prober->start(fileIndex, ids);
+}
+
+void ImageViewer::headersProbed()
+{
+    bool unreadable = false;
+    foreach (const HeaderProber::Result &result, prober->takeResults()) {
+        if (result.id >= fileIndex.idCount() || !fileIndex.isLive(result.id))
+            continue;
+        fileIndex.setMeta(result.id, result.meta);
+        probedInPass++;
+        if (result.meta.state == FileIndex::Unreadable) {
+            unreadableInPass++;
+            unreadable = true;
+        }
+        indexDirty = true;
+    }
+    if (unreadable)
+        dropRemovedPicks();
+}
+
+void ImageViewer::headerProbeFinished()
+{
+    // One line per pass; a folder of broken files would flood the log.
+    qDebug() << "Header probe done," << probedInPass << "files probed," << unreadableInPass << "unreadable";
+    if (mirrorPending && !scanner->isRunning())
+        startMirror();
+    if (indexDirty && !scanner->isRunning()) {
+        if (fileIndex.save(FileIndex::defaultLocation()))
+            indexDirty = false;
+        else
+            qDebug() << "Cannot write index" << FileIndex::defaultLocation();
+    }
+}
+
+// Bring the display mirror up to date with every readable file. Files
+// whose copy is current are only checked against their mtime.
+void ImageViewer::startMirror()
+{
+    mirrorPending = false;
+    if (mirrorWidth <= 0 || sourcepath.isEmpty())
+        return;
+    QVector<quint32> ids;
+    for (quint32 id = 0; id < fileIndex.idCount(); ++id) {
+        if (fileIndex.isLive(id) && !fileIndex.isUnreadable(id))
+            ids.append(id);
+    }
+    qDebug() << "Mirroring" << ids.size() << "files at" << mirrorWidth << "px to"
+             << DisplayMirror::cacheDir(sourcepath);
+    mirror->start(fileIndex, ids);
+}
+
+void ImageViewer::rescanFileList()
+{
+    if (sourcepath.isEmpty() || scanner->isRunning())
+        return;
+    qDebug() << "Revalidating" << sourcepath;
+    streamFileList = false;
+    scanner->start(sourcepath, fileIndex.pattern(), fileIndex);
+}
+
+// Ids are only meaningful within one index, so history and the pick queue
+// are carried over to a replacement by path.
+void ImageViewer::adoptIndex(const FileIndex &newIndex)
+{
+    const QVector<quint32> past = history.toVector();
+    QStringList paths;
+    foreach (quint32 id, past)
+        paths.append(fileIndex.filePath(id));
+    foreach (quint32 id, pickQueue)
+        paths.append(fileIndex.filePath(id));
+    paths.append(waitingFor);
+
+    // Batched picks were marked shown without being picked yet.
+    foreach (quint32 id, batchPicks)
+        fileIndex.setShown(id, false);
+    batchPicks.clear();
+    const FileIndex older = fileIndex;
+    fileIndex = newIndex;
+    fileIndex.mergeMeta(older);
+    shuffle.reset(0, 0);
+    const QVector<qint64> ids = fileIndex.findFiles(paths);
+
+    // The cursor stays on the same entry, or the next older one if that
+    // file is gone.
+    const int position = history.position();
+    int newPosition = 0;
+    history.clear();
+    for (int i = 0; i < past.size(); ++i) {
+        if (ids.at(i) < 0)
+            continue;
+        history.push(quint32(ids.at(i)));
+        if (past.size() - 1 - i < position)
+            newPosition++;
+    }
+    history.setPosition(newPosition);
+
+    QVector<quint32> queue;
+    for (int i = 0; i < pickQueue.size(); ++i) {
+        const qint64 id = ids.at(past.size() + i);
+        if (id >= 0)
+            queue.append(quint32(id));
+    }
+    pickQueue.swap(queue);
+
+    const qint64 waiting = ids.last();
+    if (waiting >= 0)
+        waitingId = quint32(waiting);
+    else
+        waitingFor.clear();
+}
+
+// Removed files leave dead ids behind. Upcoming picks of removed or
+// unreadable files are dropped right away; prev() and next() step over
+// such history entries.
+void ImageViewer::dropRemovedPicks()
+{
+    QVector<quint32> kept;
+    kept.reserve(pickQueue.size());
+    foreach (quint32 id, pickQueue) {
+        if (fileIndex.isLive(id) && !fileIndex.isUnreadable(id))
+            kept.append(id);
+    }
+    pickQueue.swap(kept);
+}
+
+void ImageViewer::watchedFileAdded(const QString &path)
+{
+    if (!fileIndex.matches(QFileInfo(path).fileName()))
+        return;
+    const QFileInfo info(path);
+    if (fileIndex.addFile(path, info.size(), info.lastModified().toMSecsSinceEpoch())) {
+        prober->add(fileIndex.idCount() - 1, path);
+        if (mirrorWidth > 0)
+            mirror->add(path);
+        indexDirty = true;
+    } else {
+        // A rewritten file has to be probed and copied again.
+        const qint64 id = fileIndex.findFile(path);
+        if (id >= 0 && fileIndex.metaAt(id).state == FileIndex::Unprobed) {
+            prober->add(quint32(id), path);
+            if (mirrorWidth > 0)
+                mirror->add(path);
+            indexDirty = true;
+        }
+    }
+}
+
+void ImageViewer::watchedFileRemoved(const QString &path)
+{
+    if (fileIndex.removeFile(path)) {
+        dropRemovedPicks();
+        indexDirty = true;
+    }
+}
+
+void ImageViewer::watchedDirAdded(const QString &path)
+{
+    QStringList pending(path);
+    while (!pending.isEmpty()) {
+        const QString dir = pending.takeLast();
+        if (fileIndex.findDir(dir) >= 0)
+            continue;
+        // Watch first so nothing created while listing is missed.
+        watcher->watch(QStringList(dir));
+        QVector<FileIndex::File> files;
+        QStringList subdirs;
+        if (!FileIndex::listDir(dir, fileIndex.pattern(), &files, &subdirs))
+            continue;
+        const quint32 first = fileIndex.idCount();
+        if (fileIndex.addDir(dir, FileIndex::modificationTime(dir), files) < 0)
+            continue;
+        for (quint32 id = first; id < fileIndex.idCount(); ++id) {
+            const QString filePath = fileIndex.filePath(id);
+            prober->add(id, filePath);
+            if (mirrorWidth > 0)
+                mirror->add(filePath);
+        }
+        pending.append(subdirs);
+        indexDirty = true;
+    }
+}
+
+void ImageViewer::watchedDirRemoved(const QString &path)
+{
+    if (fileIndex.findDir(path) < 0)
+        return;
+    fileIndex.removeDir(path);
+    dropRemovedPicks();
+    indexDirty = true;
+}
+
+// Fallback watchers only say that something in path changed, so compare
+// the directory with what the index holds for it.
+void ImageViewer::watchedDirChanged(const QString &path)
+{
+    const int d = fileIndex.findDir(path);
+    if (d < 0)
+        return;
+    QVector<FileIndex::File> files;
+    QStringList subdirs;
+    if (!FileIndex::listDir(path, fileIndex.pattern(), &files, &subdirs)) {
+        watchedDirRemoved(path);
+        return;
+    }
+    QSet<QString> present;
+    foreach (const FileIndex::File &file, files)
+        present.insert(file.name);
+    foreach (const FileIndex::File &file, fileIndex.filesOf(d)) {
+        if (!present.contains(file.name))
+            watchedFileRemoved(path + QLatin1Char('/') + file.name);
+    }
+    // New and rewritten files are handled as if the watcher had reported them.
+    foreach (const FileIndex::File &file, files)
+        watchedFileAdded(path + QLatin1Char('/') + file.name);
+
+    const QSet<QString> presentDirs = subdirs.toSet();
+    QStringList knownDirs;
+    const int parent = fileIndex.findDir(path);
+    for (int i = parent + 1; i < fileIndex.dirCount(); ++i) {
+        if (fileIndex.dirAt(i).parent == parent)
+            knownDirs.append(fileIndex.dirAt(i).path);
+    }
+    foreach (const QString &dir, knownDirs) {
+        if (!presentDirs.contains(dir))
+            watchedDirRemoved(dir);
+    }
+    foreach (const QString &dir, subdirs)
+        watchedDirAdded(dir);
 }
 
 void ImageViewer::closeEvent(QCloseEvent *event)
 {
     qDebug() << "in closeEvent";
 
+        if (indexDirty)
+            fileIndex.save(FileIndex::defaultLocation());
         writeSettings();
         event->accept();
 }
@@ -565,6 +1408,25 @@ void ImageViewer::writeSettings()
     settings.setValue("position", pos());
     settings.setValue("size", size());
     settings.setValue("delay", delay);
+    settings.setValue("prefetchThreads", prefetchThreads);
+    settings.setValue("prefetchDepth", prefetchDepth);
+    settings.setValue("frameCacheMB", frameCacheMB);
+    settings.setValue("historyDepth", historyDepth);
+    settings.setValue("tileCacheMB", tileCacheMB);
+    settings.setValue("scanThreads", scanThreads);
+    settings.setValue("probeThreads", probeThreads);
+    settings.setValue("dirBatch", dirBatch);
+    settings.setValue("thumbnailCacheMB", thumbnailCacheMB);
+    settings.setValue("thumbnailThreads", thumbnailThreads);
+    settings.setValue("mirrorWidth", mirrorWidth);
+    settings.setValue("mirrorThreads", mirrorThreads);
+    settings.setValue("mirrorReadMBps", mirrorReadMBps);
+    settings.setValue("exportSize", exportSize);
+    settings.setValue("exportFormat", exportFormat);
+    settings.setValue("exportQuality", exportQuality);
+    settings.setValue("rescanMinutes", rescanMinutes);
+    settings.setValue("skimSettleMs", skimSettleMs);
+    settings.setValue("skimProxyWidth", skimProxyWidth);
 }
 
 void ImageViewer::readSettings()
@@ -572,24 +1434,179 @@ void ImageViewer::readSettings()
     QSettings settings(QCoreApplication::organizationName(), QCoreApplication::applicationName());
     sourcepath = settings.value("sourcepath").toString();
     delay = settings.value("delay", 4000).toInt();
+    prefetchThreads = qMax(1, settings.value("prefetchThreads", 2).toInt());
+    prefetchDepth = qMax(1, settings.value("prefetchDepth", 3).toInt());
+    frameCacheMB = qMax(0, settings.value("frameCacheMB", 256).toInt());
+    historyDepth = qMax(1, settings.value("historyDepth", 1000).toInt());
+    tileCacheMB = qMax(1, settings.value("tileCacheMB", 64).toInt());
+    scanThreads = qMax(1, settings.value("scanThreads", qMax(4, QThread::idealThreadCount())).toInt());
+    rescanMinutes = qMax(1, settings.value("rescanMinutes", 30).toInt());
+    probeThreads = qMax(1, settings.value("probeThreads", 2).toInt());
+    dirBatch = qMax(1, settings.value("dirBatch", 1).toInt());
+    thumbnailCacheMB = qMax(1, settings.value("thumbnailCacheMB", 64).toInt());
+    thumbnailThreads = qMax(1, settings.value("thumbnailThreads", 2).toInt());
+    mirrorWidth = qMax(0, settings.value("mirrorWidth", 0).toInt());
+    mirrorThreads = qMax(1, settings.value("mirrorThreads", 2).toInt());
+    mirrorReadMBps = qMax(0, settings.value("mirrorReadMBps", 0).toInt());
+    exportSize = settings.value("exportSize", "1920x1080").toString();
+    exportFormat = settings.value("exportFormat", "jpg").toString();
+    exportQuality = qBound(-1, settings.value("exportQuality", 90).toInt(), 100);
+    skimSettleMs = qMax(50, settings.value("skimSettleMs", 250).toInt());
+    skimProxyWidth = qMax(64, settings.value("skimProxyWidth", 640).toInt());
     move(settings.value("position", QPoint(800, 10)).toPoint());
     resize(settings.value("size", QSize(200, 200)).toSize());
 }
 
 void ImageViewer::pickFile()
 {
-    int i = fileList.length() * (double)((double)qrand() / (double)RAND_MAX);
-//  qDebug() << "l=" << fileList.length() << "i = " << i;
-//    qDebug() << "file = " << fileList.at(i);
-    if (currFileName != "") {
-        prevList.push_front(currFileName);
+    TRACE_SPAN("pickFile");
+    if (fileIndex.isEmpty())
+        return;
+    fillPickQueue();
+    if (pickQueue.isEmpty())
+        return;
+    const quint32 id = pickQueue.takeFirst();
+    const QString fileName = fileIndex.filePath(id);
+    ImageLoader::Frame frame;
+    const bool ready = loader->take(fileName, &frame);
+    waitingFor = ready ? QString() : fileName;
+    waitingId = id;
+    fillPickQueue();
+
+    if (!ready) {
+        // Not decoded yet: keep the current frame and swap in when ready.
+        tickMisses++;
+        return;
+    }
+    if (frame.image.isNull()) {
+        qDebug() << "Skipping" << fileName << frame.errorString;
+        fileIndex.markUnreadable(id);
+        indexDirty = true;
+        return;
     }
-    loadFile(fileList.at(i));
+    history.push(waitingId);
+    showImage(fileName, frame.image, frame.sourceSize);
+    scheduler->frameShown();
+}
+
+// A pick is requested about one interval ahead per place in the queue, so
+// at short intervals the queue grows until the front of it gets a whole
+// decode's time before its deadline.
+int ImageViewer::pickQueueDepth() const
+{
+    const int needed = qCeil(loader->decodeMs() / qMax(1, delay)) + 1;
+    return qMax(prefetchDepth, qMin(needed, 32));
+}
 
+void ImageViewer::fillPickQueue()
+{
+    loader->setTargetSize(displayTargetSize());
+    const int depth = pickQueueDepth();
+    quint32 id;
+    while (pickQueue.size() < depth && nextShuffled(&id))
+        pickQueue.append(id);
+    QStringList upcoming;
+    foreach (quint32 id, pickQueue)
+        upcoming.append(fileIndex.filePath(id));
+    QSet<QString> keep = upcoming.toSet();
+    if (!waitingFor.isEmpty())
+        keep.insert(waitingFor);
+    loader->retainOnly(keep);
+    for (int i = 0; i < pickQueue.size(); ++i)
+        loader->request(upcoming.at(i), fileIndex.fileAt(pickQueue.at(i)).mtime);
+}
+
+// qrand() only has 15 bits on Windows, so two draws are combined.
+static quint32 shuffleSeed()
+{
+    return quint32(qrand()) * (quint32(RAND_MAX) + 1u) + quint32(qrand());
+}
+
+// Every live, readable file is picked once per round. The bag walks the
+// ids in shuffled order and skips files already shown, which is what
+// carries a round over index replacements: the shown flags are kept, and
+// a new pass simply starts over them. The pass itself is saved with the
+// index, so a restart resumes it rather than walking past every file shown
+// so far. Files left unshown behind the pass, e.g. ids added during it,
+// get a new pass before the round ends; the index's count of unshown files
+// tells when the round is over without a walk. With dirBatch
+// above 1, a pick brings up to dirBatch - 1 unshown files of its folder
+// along, so prefetch reads stay in one directory for a while.
+bool ImageViewer::nextShuffled(quint32 *id)
+{
+    while (!batchPicks.isEmpty()) {
+        *id = batchPicks.takeFirst();
+        if (fileIndex.isLive(*id) && !fileIndex.isUnreadable(*id))
+            return true;
+    }
+
+    bool newRound = false;
+    bool newPass = false;
+    for (;;) {
+        quint32 next;
+        if (fileIndex.unshownCount() > 0 && shuffle.next(&next)) {
+            if (next < fileIndex.idCount() && fileIndex.isLive(next)
+                && !fileIndex.isUnreadable(next) && !fileIndex.isShown(next)) {
+                *id = next;
+                break;
+            }
+            continue;
+        }
+        if (fileIndex.unshownCount() > 0 && !newPass) {
+            shuffle.reset(fileIndex.idCount(), shuffleSeed());
+            newPass = true;
+            continue;
+        }
+        // A whole round found nothing: no file can be shown.
+        if (newRound || fileIndex.isEmpty())
+            return false;
+        qDebug() << "Shuffle round over after" << fileIndex.shownCount() << "files";
+        fileIndex.clearShown();
+        shuffle.reset(fileIndex.idCount(), shuffleSeed());
+        newRound = true;
+        newPass = true;
+    }
+    fileIndex.setShown(*id, true);
+    const FileIndex::ShufflePass pass = { shuffle.count(), shuffle.seed(), shuffle.position() };
+    fileIndex.setShufflePass(pass);
+    indexDirty = true;
+
+    // The files of a folder have neighbouring ids; look both ways.
+    const int dir = fileIndex.dirOf(*id);
+    for (int step = 1; step >= -1; step -= 2) {
+        for (qint64 n = qint64(*id) + step; n >= 0 && n < qint64(fileIndex.idCount())
+             && batchPicks.size() < dirBatch - 1 && fileIndex.dirOf(n) == dir; n += step) {
+            if (!fileIndex.isShown(n) && !fileIndex.isUnreadable(n)) {
+                fileIndex.setShown(n, true);
+                batchPicks.append(n);
+            }
+        }
+    }
+    return true;
+}
+
+void ImageViewer::frameReady(const QString &fileName)
+{
+    if (fileName != waitingFor)
+        return;
+    waitingFor.clear();
+    ImageLoader::Frame frame;
+    if (!loader->take(fileName, &frame) || frame.image.isNull()) {
+        qDebug() << "Skipping" << fileName << frame.errorString;
+        if (waitingId < fileIndex.idCount() && fileIndex.filePath(waitingId) == fileName) {
+            fileIndex.markUnreadable(waitingId);
+            indexDirty = true;
+        }
+        return;
+    }
+    history.push(waitingId);
+    showImage(fileName, frame.image, frame.sourceSize);
+    scheduler->frameShown();
 }
 
 void ImageViewer::changeFile()
 {
+    TRACE_SPAN("changeFile");
     if (showMenu && (! pauseDisplayPerm) ) {
         idleCount++;
         if (idleCount >= 3) {
@@ -604,23 +1621,40 @@ void ImageViewer::changeFile()
     }
     if ( (! pauseDisplay) && (! pauseDisplayPerm) ) {
         pickFile();
+    } else {
+        scheduler->frameDropped();
     }
 }
 
 void ImageViewer::startDisplayLoop()
 {
-    if (timer != NULL) {
-        timer->stop();
-    }
-    timer = new QTimer(this);
-    connect(timer, SIGNAL(timeout()), this, SLOT(changeFile()));
-    timer->start(delay);
+    scheduler->setInterval(delay);
+    delay = scheduler->interval();
+    scheduler->start();
+}
+
+void ImageViewer::stopDisplayLoop()
+{
+    scheduler->stop();
+}
+
+bool ImageViewer::isIndexing() const
+{
+    return scanner->isRunning() || prober->isRunning();
 }
 
 
 void ImageViewer::mouseMoveEvent(QMouseEvent *event)
 {
-    if (event->buttons() & Qt::LeftButton) {
+    if ((event->buttons() & Qt::LeftButton) && !fitToWindowAct->isChecked()) {
+        // Zoomed in: dragging pans the image instead of moving the window.
+        const QPoint delta = event->globalPos() - m_panPosition;
+        m_panPosition = event->globalPos();
+        scrollArea->horizontalScrollBar()->setValue(scrollArea->horizontalScrollBar()->value() - delta.x());
+        scrollArea->verticalScrollBar()->setValue(scrollArea->verticalScrollBar()->value() - delta.y());
+        idleCount = 0;
+        event->accept();
+    } else if (event->buttons() & Qt::LeftButton) {
         move(event->globalPos() - m_dragPosition);
         idleCount = 0;
         event->accept();
@@ -631,6 +1665,7 @@ void ImageViewer::mousePressEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton) {
         m_dragPosition = event->globalPos() - frameGeometry().topLeft();
+        m_panPosition = event->globalPos();
         idleCount = 0;
         event->accept();
     }
@@ -651,6 +1686,7 @@ void ImageViewer::pause() {
     pauseDisplay = true;
     pauseDisplayPerm = true;
     idleCount = 0;
+    scheduler->frameDropped();
 
 }
 void ImageViewer::resume() {
@@ -662,42 +1698,165 @@ void ImageViewer::resume() {
     pauseDisplay = false;
     pauseDisplayPerm = false;
     idleCount = 0;
+    stopSkim();
     pickFile();
-    prevCount = 0;
 }
 
 void ImageViewer::prev() {
-    qDebug() << "in prev count" << prevCount << "of" << prevList.length();
+    qDebug() << "in prev at" << history.position() << "of" << history.size();
     pauseDisplay = true;
     pauseDisplayPerm = true;
-    qDebug() << "pl0" << prevList.at(0);
-    qDebug() << "cFN" << currFileName;
-    if ((prevCount == 0) && (prevList.at(0) != currFileName)){
-        prevList.push_front(currFileName);
-        prevCount++;
-    }
     idleCount = 0;
-    if (prevCount >= prevList.length() ) {
-        prevCount = prevList.length() - 1;
+    const bool held = noteInput();
+    const int start = history.position();
+    quint32 id;
+    while (history.back(&id)) {
+        if (fileIndex.isLive(id) && !fileIndex.isUnreadable(id)) {
+            skimTo(fileIndex.filePath(id), held);
+            return;
+        }
     }
-    loadFile(prevList.at(prevCount));
-    prevCount++;
-
+    // Nothing older is left; stay where we were.
+    history.setPosition(start);
+    inputPending = false;
 }
 
 void ImageViewer::next() {
-    qDebug() << "in next count" << prevCount;
+    qDebug() << "in next at" << history.position() << "of" << history.size();
     pauseDisplay = true;
     pauseDisplayPerm = true;
     idleCount = 0;
-    prevCount--;
-    if (prevCount <0) {
-        prevCount = 0;
-        pickFile();
+    const bool held = noteInput();
+    quint32 id;
+    while (history.forward(&id)) {
+        if (fileIndex.isLive(id) && !fileIndex.isUnreadable(id)) {
+            skimTo(fileIndex.filePath(id), held);
+            return;
+        }
     }
-    else {
-        loadFile(prevList.at(prevCount));
+    // Past the end of the history: a new pick, up once it is decoded.
+    stopSkim();
+    inputPending = true;
+    pickFile();
+}
+
+// Records a press of prev or next. Returns true if it came soon enough
+// after the one before to be a held key.
+bool ImageViewer::noteInput()
+{
+    const bool held = lastInput.isValid() && lastInput.elapsed() < skimSettleMs;
+    lastInput.start();
+    inputPending = true;
+    return held;
+}
+
+// prev() and next() never wait for a decode. A frame in the cache is
+// shown at once; otherwise the file is handed to the skim loader, which
+// drops whatever it was doing for an earlier press. While a key is held
+// only a proxy is decoded, and the full frame follows once the presses
+// have stopped for skimSettleMs.
+void ImageViewer::skimTo(const QString &fileName, bool held)
+{
+    TRACE_SPAN("skimTo");
+    waitingFor.clear();
+    openFile.clear();
+    skimFile = fileName;
+    const QSize target = displayTargetSize();
+    ImageLoader::Frame frame;
+    if (loader->cached(fileName, modificationTime(fileName), target, &frame)) {
+        skimmer->cancel();
+        skimSettle->stop();
+        skimProxyShown = false;
+        showImage(fileName, frame.image, frame.sourceSize);
+        fullFrameShown();
+        return;
+    }
+    if (held) {
+        skimmer->request(fileName, QSize(qMin(skimProxyWidth, target.width()), 0), true);
+        skimSettle->start(skimSettleMs);
+    } else {
+        skimSettle->stop();
+        skimmer->request(fileName, target, false);
+    }
+}
+
+void ImageViewer::stopSkim()
+{
+    skimmer->cancel();
+    skimSettle->stop();
+    skimFile.clear();
+    openFile.clear();
+    openFallbackFile.clear();
+    openFallback = ImageLoader::Frame();
+    inputPending = false;
+}
+
+void ImageViewer::skimFrameReady(const QString &fileName, bool proxy)
+{
+    ImageLoader::Frame frame;
+    if (fileName != skimFile || !skimmer->take(&frame))
+        return;
+    const bool opened = fileName == openFile;
+    openFile.clear();
+    if (frame.image.isNull()) {
+        qDebug() << "Cannot load" << fileName << frame.errorString;
+        inputPending = false;
+        if (opened) {
+            openFailed(fileName, frame.errorString);
+            return;
+        }
+        statusBar()->showMessage(tr("Cannot load %1: %2")
+                                 .arg(QDir::toNativeSeparators(fileName), frame.errorString));
+        return;
+    }
+    if (!proxy)
+        loader->insertCached(fileName, frame);
+    skimProxyShown = proxy;
+    openFallbackFile.clear();
+    openFallback = ImageLoader::Frame();
+    showImage(fileName, frame.image, frame.sourceSize);
+    if (opened)
+        return;
+    if (!proxy)
+        fullFrameShown();
+    else if (!skimSettle->isActive())
+        skimSettled(); // the keys were released while it decoded
+}
+
+// Input has stopped: bring the proxy on screen, or still decoding, up to
+// full quality.
+void ImageViewer::skimSettled()
+{
+    if (skimFile.isEmpty() || (currFileName == skimFile && !skimProxyShown))
+        return;
+    skimmer->request(skimFile, displayTargetSize(), false);
+}
+
+void ImageViewer::fullFrameShown()
+{
+    fullFrames++;
+    fullLatencySum += lastInput.nsecsElapsed() / 1e6;
+}
+
+// The decode loadFile() handed off failed. Its preview must not stay up
+// under the broken file's name, so the frame from before comes back, or
+// the view is cleared if there was none.
+void ImageViewer::openFailed(const QString &fileName, const QString &errorString)
+{
+    if (currFileName == fileName) {
+        if (openFallbackFile.isEmpty()) {
+            currFileName.clear();
+            setImage(QImage(), QSize());
+            setWindowFilePath(QString());
+        } else {
+            showImage(openFallbackFile, openFallback.image, openFallback.sourceSize);
+        }
     }
+    openFallbackFile.clear();
+    openFallback = ImageLoader::Frame();
+    QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                             tr("Cannot load %1: %2")
+                             .arg(QDir::toNativeSeparators(fileName), errorString));
 }
 
 void ImageViewer::openFolderInExplorer() {
@@ -724,7 +1883,6 @@ void ImageViewer::openFileInPhotos() {
 }
 
 void ImageViewer::enterEvent(QEvent *event){
-    qDebug() << "In enter mb" << menuBar()->isVisible();
     if ( ! menuBar()->isVisible() ) {
         menuBar()->show();
         statusBar()->show();
@@ -738,7 +1896,6 @@ void ImageViewer::enterEvent(QEvent *event){
 }
 
 void ImageViewer::leaveEvent(QEvent *event){
-    qDebug() << "In leave mb" << menuBar()->isVisible() << imageLabel->underMouse() << scrollArea->underMouse() << menuBar()->underMouse();
     event->accept();
 }
 void ImageViewer::showFileInfo() {
@@ -757,39 +1914,90 @@ void ImageViewer::showFileInfo() {
 void ImageViewer::decreaseDelay() {
 
     qDebug() << "In decDelay";
-    delay -= 1000;
-    if (delay < 1000) {
-        delay = 1000;
-    }
-    statusBar()->showMessage(tr("Delay is %1 seconds").arg((int) delay/1000));
+    // Whole seconds down to one, then halving for fast review.
+    if (delay > 1000)
+        delay = qMax(1000, delay - 1000);
+    else
+        delay = qMax<int>(DisplayScheduler::MinInterval, delay / 2);
     startDisplayLoop();
+    statusBar()->showMessage(tr("Delay is %1 seconds").arg(delay / 1000.0));
 }
 
 void ImageViewer::increaseDelay() {
 
     qDebug() << "In incDelay";
-    delay += 1000;
-    if (delay > 60000) {
-        delay = 60000;
-    }
-    statusBar()->showMessage(tr("Delay is %1 seconds").arg((int) delay/1000));
+    if (delay < 1000)
+        delay = qMin(1000, delay * 2);
+    else
+        delay += 1000;
     startDisplayLoop();
+    statusBar()->showMessage(tr("Delay is %1 seconds").arg(delay / 1000.0));
 }
 
 void ImageViewer::setDelay() {
     qDebug() << "in setDelay";
     bool ok;
-    int i = QInputDialog::getInt(this, tr("Set delay in seconds"),
-                                 tr("Seconds:"), (int) delay/1000, 1, 60, 1, &ok);
+    double seconds = QInputDialog::getDouble(this, tr("Set delay in seconds"),
+                                             tr("Seconds:"), delay / 1000.0,
+                                             DisplayScheduler::MinInterval / 1000.0,
+                                             DisplayScheduler::MaxInterval / 1000.0, 2, &ok);
     if (ok) {
-        if (i < 1) {
-            i = 1;
-        }
-        if (i > 60) {
-            i = 60;
-        }
-        delay = i * 1000;
-        statusBar()->showMessage(tr("Delay is %1 seconds").arg((int) delay/1000));
+        delay = qRound(seconds * 1000);
         startDisplayLoop();
+        statusBar()->showMessage(tr("Delay is %1 seconds").arg(delay / 1000.0));
     }
 }
+
+void ImageViewer::showStats() {
+    QStringList lines;
+    const FileIndex::ProbeStats probe = fileIndex.probeStats();
+    lines << tr("Files: %1 in %2 folders").arg(fileIndex.fileCount()).arg(fileIndex.dirCount())
+          << tr("Headers probed: %1, unreadable: %2, queued: %3")
+             .arg(probe.probed).arg(probe.unreadable).arg(prober->remaining())
+          << tr("File list memory: %1 KB, %2 bytes per file")
+             .arg(fileIndex.memoryUsage() / 1024).arg(fileIndex.bytesPerFile(), 0, 'f', 1)
+          << tr("Watched folders: %1, not watched: %2")
+             .arg(watcher->watchedCount()).arg(watcher->unwatchedCount())
+          << tr("Prefetch: %1 threads, %2 deep, decodes take %3 ms")
+             .arg(loader->maxThreads()).arg(pickQueueDepth()).arg(loader->decodeMs(), 0, 'f', 1)
+          << tr("Tick misses: %1, view rescales: %2, GUI format conversions: %3")
+             .arg(tickMisses).arg(imageView->scaleCount()).arg(imageView->conversionCount())
+          << tr("Zoom tiles: %1 cached, %2 built")
+             .arg(imageView->tiles().tilesCached()).arg(imageView->tiles().tilesBuilt())
+          << tr("Shuffle: %1 of %2 files shown this round")
+             .arg(fileIndex.shownCount()).arg(fileIndex.fileCount())
+          << tr("History: %1 of %2 entries, %3 back")
+             .arg(history.size()).arg(history.capacity()).arg(history.position());
+    const DisplayScheduler::Stats schedule = scheduler->stats();
+    lines << tr("Deadlines: %1 ticks every %2 ms, %3 late by over %4 ms, %5 skipped")
+             .arg(schedule.ticks).arg(scheduler->interval()).arg(schedule.late)
+             .arg(scheduler->lateMs()).arg(schedule.skipped)
+          << tr("Deadline jitter: %1 ms mean, %2 ms max; ticks fire %3 ms early")
+             .arg(schedule.meanJitterMs, 0, 'f', 1).arg(schedule.maxJitterMs, 0, 'f', 1)
+             .arg(schedule.leadMs, 0, 'f', 1);
+    const SkimLoader::Stats skim = skimmer->stats();
+    lines << tr("Skim decodes: %1 requested, %2 delivered, %3 superseded, %4 cancelled while decoding")
+             .arg(skim.requested).arg(skim.decoded).arg(skim.superseded).arg(skim.cancelled)
+          << tr("Input to photon: %1 frames, %2 ms mean, %3 ms max; full quality %4 ms after the last key")
+             .arg(inputFrames).arg(inputFrames > 0 ? inputLatencySum / inputFrames : 0, 0, 'f', 1)
+             .arg(inputLatencyMax, 0, 'f', 1)
+             .arg(fullFrames > 0 ? fullLatencySum / fullFrames : 0, 0, 'f', 1);
+    const ThumbnailCache::Stats thumbs = thumbnails->stats();
+    lines << tr("Thumbnails: %1 in memory, %2 of %3 MB; %4 read, %5 generated, %6 failed")
+             .arg(thumbs.pixmaps).arg(thumbs.bytes / (1024 * 1024)).arg(thumbnailCacheMB)
+             .arg(thumbs.loaded).arg(thumbs.generated).arg(thumbs.failed);
+    const DisplayMirror::Stats mirrored = mirror->stats();
+    lines << tr("Display mirror: %1 made, %2 current, %3 failed, %4 queued; %5 of %6 loads from it")
+             .arg(mirrored.made).arg(mirrored.fresh).arg(mirrored.failed).arg(mirrored.remaining)
+             .arg(mirrored.hits).arg(mirrored.hits + mirrored.misses);
+    const MappedFile::Stats reads = MappedFile::stats();
+    lines << tr("File reads: %1 files, %2 MB mapped, %3 MB copied")
+             .arg(reads.files).arg(reads.mappedBytes / (1024 * 1024)).arg(reads.copiedBytes / (1024 * 1024));
+    const ImageLoader::CacheStats cache = loader->cacheStats();
+    lines << tr("Frame cache: %1 frames, %2 of %3 MB")
+             .arg(cache.frames).arg(cache.bytes / (1024 * 1024)).arg(frameCacheMB)
+          << tr("Cache hits: %1, misses: %2, evictions: %3")
+             .arg(cache.hits).arg(cache.misses).arg(cache.evictions);
+    QMessageBox::information(this, QGuiApplication::applicationDisplayName(),
+                             lines.join(QLatin1Char('\n')));
+}
@@ -58,24 +58,50 @@
 #endif
 #include <QStringList>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QTimer>
 
+#include "fileindex.h"
+#include "historyring.h"
+#include "imageloader.h"
+#include "shufflebag.h"
+
 QT_BEGIN_NAMESPACE
 class QAction;
-class QLabel;
 class QMenu;
+class QProgressDialog;
 class QScrollArea;
 class QScrollBar;
+class QStackedWidget;
 QT_END_NAMESPACE
 
+class DirWatcher;
+class DisplayMirror;
+class DisplayScheduler;
+class HeaderProber;
+class ImageExporter;
+class ImageView;
+class IndexScanner;
+class SkimLoader;
+class ThumbnailCache;
+class ThumbnailGrid;
+
 //! [0]
 class ImageViewer : public QMainWindow
 {
     Q_OBJECT
 
 public:
-    ImageViewer();
+    // source, if given, is shown instead of the configured folder.
+    explicit ImageViewer(const QString &source = QString());
     bool loadFile(const QString &);
+    // For driving the slideshow from outside, as the headless bench does:
+    // stop the display timer and call changeFile() instead.
+    void stopDisplayLoop();
+    // A scan or header probe of the file list is in flight.
+    bool isIndexing() const;
+    int tickMissCount() const { return tickMisses; }
+    DisplayScheduler *displayScheduler() const { return scheduler; }
 
 protected:
     void closeEvent(QCloseEvent *event) override;
@@ -88,6 +114,10 @@ private slots:
     void openDir();
     void open();
     void saveAs();
+    void saveFinished();
+    void exportImages();
+    void exportProgressed(int done, int total);
+    void exportFinished();
     void print();
     void copy();
     void paste();
@@ -108,38 +138,143 @@ private slots:
     void decreaseDelay();
     void increaseDelay();
     void setDelay();
+    void showStats();
+    void saveTrace();
+    void browse();
+    void closeBrowse();
+    void thumbnailActivated(const QString &fileName);
+    void frameReady(const QString &fileName);
+    void skimFrameReady(const QString &fileName, bool proxy);
+    void skimSettled();
+    void requestRegion(const QRect &rect);
+    void regionReady(const QString &fileName, const QRect &rect, const QImage &region);
+    void sizedFrameReady(const QString &fileName, const QSize &targetSize,
+                         const ImageLoader::Frame &frame);
+    void cancelFullImage();
+    void fileListScanned();
+    void headersProbed();
+    void headerProbeFinished();
+    void fileListProgress();
+    void rescanFileList();
+    void watchedFileAdded(const QString &path);
+    void watchedFileRemoved(const QString &path);
+    void watchedDirAdded(const QString &path);
+    void watchedDirRemoved(const QString &path);
+    void watchedDirChanged(const QString &path);
 
 private:
     void createActions();
     void createMenus();
     void updateActions();
-    bool saveFile(const QString &fileName);
-    void setImage(const QImage &newImage);
+    void saveFile(const QString &fileName);
+    enum Output { NoOutput, PrintOutput, CopyOutput };
+    void requestFullImage(Output output);
+    void useFullImage(Output output, const QImage &page);
+    void setImage(const QImage &newImage, const QSize &sourceSize = QSize());
     void scaleImage(double factor);
     void adjustScrollBar(QScrollBar *scrollBar, double factor);
+    void leaveFitToWindow();
     void buildFileList(const QString &dir);
-    void findRecursion(const QString &path, const QString &pattern, QStringList *result);
     void writeSettings();
     void readSettings();
     void startDisplayLoop();
     void pickFile();
+    bool nextShuffled(quint32 *id);
+    void adoptIndex(const FileIndex &newIndex);
+    void dropRemovedPicks();
+    int pickQueueDepth() const;
+    void fillPickQueue();
+    bool noteInput();
+    void skimTo(const QString &fileName, bool held);
+    void stopSkim();
+    void fullFrameShown();
+    void openFailed(const QString &fileName, const QString &errorString);
+    void showImage(const QString &fileName, const QImage &newImage, const QSize &sourceSize);
+    void fitWindowTo(const QSize &imageSize);
+    void startHeaderProbe();
+    void startMirror();
+    QSize displayTargetSize() const;
+    qint64 modificationTime(const QString &fileName) const;
+    void ensureResolution(const QSize &needed);
 
     QImage image;
-    QLabel *imageLabel;
+    QSize imageSourceSize; // full size of the file behind image
+    QSize baseSize;        // size scaleFactor is relative to
+    ImageView *imageView;
     QScrollArea *scrollArea;
+    QStackedWidget *stack; // scrollArea, or the grid while browsing
+    ThumbnailCache *thumbnails;
+    ThumbnailGrid *grid;
+    int thumbnailCacheMB;
+    int thumbnailThreads;
     double scaleFactor;
     QPoint m_dragPosition;
+    QPoint m_panPosition;
     QString sourcepath;
-    QStringList fileList;
+    FileIndex fileIndex; // the files the slideshow picks from
+    IndexScanner *scanner;
+    bool streamFileList; // add scan batches to fileIndex as they arrive
+    int scanThreads;
+    DirWatcher *watcher;
+    HeaderProber *prober; // fills in the index's per-file metadata
+    int probeThreads;
+    int probedInPass;     // by the current header probe, for its summary
+    int unreadableInPass;
+    DisplayMirror *mirror; // display-sized copies of a slow source
+    bool mirrorPending;    // a pass is due once the header probe is done
+    int mirrorWidth;       // 0 turns the mirror off
+    int mirrorThreads;
+    int mirrorReadMBps;
+    bool indexDirty;   // fileIndex changed since it was last saved
+    int rescanMinutes; // revalidation interval when not every folder is watched
+    QTimer *rescanTimer;
     bool showMenu;
     int idleCount;
     bool pauseDisplay;
     bool pauseDisplayPerm;
     QString currFileName;
-    QStringList prevList;
-    int prevCount;
+    HistoryRing history; // ids of the picks shown, for prev() and next()
+    int historyDepth;
+    int tileCacheMB;
     int delay; // milliseconds
-    QTimer *timer;
+    DisplayScheduler *scheduler;
+    ImageLoader *loader;
+    QVector<quint32> pickQueue; // ids of upcoming picks, decoded ahead of time
+    ShuffleBag shuffle;         // order of the current round over the ids
+    QVector<quint32> batchPicks; // more files of the last pick's folder
+    int dirBatch;               // picks taken from one folder in a row
+    QString waitingFor;         // pick whose decode missed its tick
+    quint32 waitingId;
+    int prefetchDepth;
+    int prefetchThreads;
+    int frameCacheMB;
+    int tickMisses;
+    SkimLoader *skimmer;     // prev() and next() decodes, latest wins
+    QTimer *skimSettle;      // runs out once the keys are released
+    QString skimFile;        // where prev() or next() went last
+    bool skimProxyShown;     // the frame up is a proxy of skimFile
+    QString openFile;        // loadFile() decode running on the skim loader
+    QString openFallbackFile; // what was up before it, for when it fails
+    ImageLoader::Frame openFallback;
+    int skimSettleMs;        // presses closer than this are a held key
+    int skimProxyWidth;
+    QElapsedTimer lastInput; // since the last prev() or next()
+    bool inputPending;       // no frame has answered it yet
+    int inputFrames;
+    double inputLatencySum;  // ms
+    double inputLatencyMax;
+    int fullFrames;          // full quality frames after skimming
+    double fullLatencySum;
+    ImageExporter *saver;    // Save As, one file at a time
+    ImageExporter *exporter; // batch export on every core
+    QProgressDialog *saveProgress;
+    QProgressDialog *exportProgress;
+    Output pendingOutput;    // waiting for a full-resolution decode
+    QProgressDialog *outputProgress;
+    QString saveTarget;
+    QString exportSize;      // WxH, or empty for full size
+    QString exportFormat;
+    int exportQuality;
 
 #ifndef QT_NO_PRINTER
     QPrinter printer;
@@ -147,6 +282,7 @@ private:
 
     QAction *openDirAct;
     QAction *saveAsAct;
+    QAction *exportAct;
     QAction *printAct;
     QAction *copyAct;
     QAction *zoomInAct;
@@ -165,6 +301,9 @@ private:
     QAction *decreaseAct;
     QAction *increaseAct;
     QAction *setDelayAct;
+    QAction *statsAct;
+    QAction *traceAct;
+    QAction *browseAct;
 
 
 
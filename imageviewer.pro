@@ -1,8 +1,52 @@
 QT += widgets core
 qtHaveModule(printsupport): QT += printsupport
 
-HEADERS       = imageviewer.h
+# Timing spans on the load and display path (see trace.h). Build with
+# CONFIG+=notrace to compile them out.
+!CONFIG(notrace): DEFINES += IMAGEVIEWER_TRACE
+
+HEADERS       = imageviewer.h \
+                dirwatcher.h \
+                displaymirror.h \
+                displayscheduler.h \
+                downscaler.h \
+                exifthumbnail.h \
+                fileindex.h \
+                headerprober.h \
+                headless.h \
+                historyring.h \
+                imageexporter.h \
+                imageloader.h \
+                imageview.h \
+                indexscanner.h \
+                mappedfile.h \
+                shufflebag.h \
+                skimloader.h \
+                thumbnailcache.h \
+                thumbnailgrid.h \
+                tilepyramid.h \
+                trace.h
 SOURCES       = imageviewer.cpp \
+                dirwatcher.cpp \
+                displaymirror.cpp \
+                displayscheduler.cpp \
+                downscaler.cpp \
+                exifthumbnail.cpp \
+                fileindex.cpp \
+                headerprober.cpp \
+                headless.cpp \
+                historyring.cpp \
+                imageexporter.cpp \
+                imageloader.cpp \
+                imageview.cpp \
+                indexscanner.cpp \
+                mappedfile.cpp \
+                shufflebag.cpp \
+                skimloader.cpp \
+                thumbnailcache.cpp \
+                thumbnailgrid.cpp \
+                tilepyramid.cpp \
+                trace.cpp \
                 main.cpp
 
 # install
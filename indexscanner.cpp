@@ -0,0 +1,321 @@
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "indexscanner.h"
+
+namespace {
+
+// Files collected before the GUI is told about a new batch, and the
+// longest it waits for a batch to fill up.
+const int batchSize = 256;
+const int batchIntervalMs = 250;
+
+struct WorkItem {
+    QString path;
+    int parent;
+};
+
+struct WorkQueue {
+    QMutex mutex;
+    QVector<WorkItem> items;
+};
+
+} // namespace
+
+struct ScanJob
+{
+    ScanJob(IndexScanner *scanner, int generation, int workers, const QString &root,
+            const QString &pattern, const FileIndex &previous)
+        : scanner(scanner), generation(generation), root(root), pattern(pattern)
+        , previous(previous), outstanding(0), running(workers), cancelled(0)
+        , batchFiles(0), notified(false)
+    {
+        if (previous.root() == root && previous.pattern() == pattern)
+            lookup = previous.dirLookup();
+        for (int i = 0; i < workers; ++i)
+            queues.append(new WorkQueue);
+        index.setRoot(root, pattern);
+        stats.files = 0;
+        stats.dirsListed = 0;
+        stats.dirsReused = 0;
+        stats.elapsedMs = 0;
+        timer.start();
+        sinceNotify.start();
+    }
+
+    ~ScanJob()
+    {
+        qDeleteAll(queues);
+    }
+
+    void push(int worker, const WorkItem &item)
+    {
+        outstanding.ref();
+        {
+            WorkQueue *queue = queues.at(worker);
+            QMutexLocker locker(&queue->mutex);
+            queue->items.append(item);
+        }
+        QMutexLocker locker(&idleMutex);
+        workAvailable.wakeOne();
+    }
+
+    // An item taken from a queue has been processed.
+    void finish()
+    {
+        if (!outstanding.deref()) {
+            QMutexLocker locker(&idleMutex);
+            workAvailable.wakeAll();
+        }
+    }
+
+    void cancel()
+    {
+        cancelled.store(1);
+        QMutexLocker locker(&idleMutex);
+        workAvailable.wakeAll();
+    }
+
+    // Blocks an idle worker until another one pushes more, the last
+    // directory is done or the scan is cancelled.
+    void waitForWork()
+    {
+        QMutexLocker locker(&idleMutex);
+        while (!cancelled.load() && outstanding.load() > 0 && !hasWork())
+            workAvailable.wait(&idleMutex);
+    }
+
+    bool hasWork()
+    {
+        foreach (WorkQueue *queue, queues) {
+            QMutexLocker locker(&queue->mutex);
+            if (!queue->items.isEmpty())
+                return true;
+        }
+        return false;
+    }
+
+    // Own queue from the back (depth first), others from the front.
+    bool take(int worker, WorkItem *item)
+    {
+        for (int i = 0; i < queues.size(); ++i) {
+            WorkQueue *queue = queues.at((worker + i) % queues.size());
+            QMutexLocker locker(&queue->mutex);
+            if (queue->items.isEmpty())
+                continue;
+            *item = i == 0 ? queue->items.takeLast() : queue->items.takeFirst();
+            return true;
+        }
+        return false;
+    }
+
+    void process(int worker, const WorkItem &item)
+    {
+        const qint64 mtime = FileIndex::modificationTime(item.path);
+        QVector<FileIndex::File> files;
+        QStringList subdirs;
+        bool reused = false;
+        const int old = lookup.byPath.value(item.path, -1);
+        if (old >= 0 && previous.dirAt(old).mtime == mtime) {
+            foreach (quint32 id, lookup.files.at(old))
+                files.append(previous.fileAt(id));
+            foreach (int child, lookup.children.at(old))
+                subdirs.append(previous.dirAt(child).path);
+            reused = true;
+        } else {
+            FileIndex::listDir(item.path, pattern, &files, &subdirs);
+        }
+
+        int dirIndex;
+        {
+            QMutexLocker locker(&resultMutex);
+            dirIndex = index.appendDir(item.path, mtime, item.parent, files);
+            if (reused)
+                stats.dirsReused++;
+            else
+                stats.dirsListed++;
+            stats.files += files.size();
+            FileIndex::DirEntries entries;
+            entries.path = item.path;
+            entries.mtime = mtime;
+            entries.parent = item.parent;
+            entries.files = files;
+            batch.append(entries);
+            batchFiles += files.size();
+            if (!notified && (batchFiles >= batchSize || sinceNotify.elapsed() >= batchIntervalMs)) {
+                notified = true;
+                QMetaObject::invokeMethod(scanner, "onProgress", Qt::QueuedConnection,
+                                          Q_ARG(int, generation));
+            }
+        }
+        foreach (const QString &subdir, subdirs)
+            push(worker, WorkItem{ subdir, dirIndex });
+    }
+
+    IndexScanner *scanner;
+    const int generation;
+    const QString root;
+    const QString pattern;
+    const FileIndex previous;
+    FileIndex::DirLookup lookup;
+    QVector<WorkQueue *> queues;
+    QAtomicInt outstanding; // directories queued or being processed
+    QAtomicInt running;     // workers that have not exited yet
+    QAtomicInt cancelled;
+    QMutex idleMutex;       // held to wait on and wake workAvailable
+    QWaitCondition workAvailable;
+
+    QMutex resultMutex;     // guards everything below
+    FileIndex index;
+    FileIndex::ScanStats stats;
+    QVector<FileIndex::DirEntries> batch;
+    int batchFiles;
+    bool notified;
+    QElapsedTimer timer;
+    QElapsedTimer sinceNotify;
+};
+
+namespace {
+
+class ScanWorker : public QRunnable
+{
+public:
+    ScanWorker(const QSharedPointer<ScanJob> &job, int worker)
+        : m_job(job), m_worker(worker) {}
+
+    void run() override
+    {
+        while (!m_job->cancelled.load()) {
+            WorkItem item;
+            if (m_job->take(m_worker, &item)) {
+                m_job->process(m_worker, item);
+                m_job->finish();
+            } else if (m_job->outstanding.load() == 0) {
+                break;
+            } else {
+                // Another worker is still listing; wait for it to push more.
+                m_job->waitForWork();
+            }
+        }
+        if (!m_job->running.deref() && !m_job->cancelled.load()) {
+            {
+                QMutexLocker locker(&m_job->resultMutex);
+                m_job->stats.elapsedMs = m_job->timer.elapsed();
+            }
+            QMetaObject::invokeMethod(m_job->scanner, "onFinished", Qt::QueuedConnection,
+                                      Q_ARG(int, m_job->generation));
+        }
+    }
+
+private:
+    QSharedPointer<ScanJob> m_job;
+    int m_worker;
+};
+
+} // namespace
+
+IndexScanner::IndexScanner(QObject *parent)
+    : QObject(parent)
+    , generation(0)
+    , running(false)
+{
+    pool.setMaxThreadCount(qMax(4, QThread::idealThreadCount()));
+}
+
+IndexScanner::~IndexScanner()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void IndexScanner::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int IndexScanner::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void IndexScanner::start(const QString &root, const QString &pattern, const FileIndex &previous)
+{
+    cancel();
+    generation++;
+    running = true;
+    const int workers = pool.maxThreadCount();
+    job = QSharedPointer<ScanJob>(new ScanJob(this, generation, workers, root, pattern, previous));
+    job->push(0, WorkItem{ root, -1 });
+    for (int i = 0; i < workers; ++i)
+        pool.start(new ScanWorker(job, i));
+}
+
+void IndexScanner::cancel()
+{
+    if (job)
+        job->cancel();
+    running = false;
+}
+
+bool IndexScanner::isRunning() const
+{
+    return running;
+}
+
+QString IndexScanner::root() const
+{
+    return job ? job->root : QString();
+}
+
+QVector<FileIndex::DirEntries> IndexScanner::takeBatch()
+{
+    QVector<FileIndex::DirEntries> batch;
+    if (job) {
+        QMutexLocker locker(&job->resultMutex);
+        batch.swap(job->batch);
+        job->batchFiles = 0;
+        job->notified = false;
+        job->sinceNotify.restart();
+    }
+    return batch;
+}
+
+FileIndex IndexScanner::result() const
+{
+    if (!job)
+        return FileIndex();
+    QMutexLocker locker(&job->resultMutex);
+    return job->index;
+}
+
+FileIndex::ScanStats IndexScanner::stats() const
+{
+    FileIndex::ScanStats stats = { 0, 0, 0, 0 };
+    if (job) {
+        QMutexLocker locker(&job->resultMutex);
+        stats = job->stats;
+        if (running)
+            stats.elapsedMs = job->timer.elapsed();
+    }
+    return stats;
+}
+
+void IndexScanner::onProgress(int scanGeneration)
+{
+    if (scanGeneration == generation && running)
+        emit progress();
+}
+
+void IndexScanner::onFinished(int scanGeneration)
+{
+    if (scanGeneration != generation || !running)
+        return;
+    running = false;
+    emit finished();
+}
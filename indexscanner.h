@@ -0,0 +1,54 @@
+#ifndef INDEXSCANNER_H
+#define INDEXSCANNER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "fileindex.h"
+
+struct ScanJob;
+
+// Builds a FileIndex on a pool of worker threads. Each worker walks its
+// own stack of directories and steals from the others when it runs dry.
+// New directories are streamed out in batches while the scan is running.
+// Starting a new scan cancels the one in flight.
+class IndexScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit IndexScanner(QObject *parent = nullptr);
+    ~IndexScanner();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+
+    void start(const QString &root, const QString &pattern, const FileIndex &previous);
+    void cancel();
+    bool isRunning() const;
+    QString root() const;
+    // Directories added since the last call, in the order they were
+    // appended to the index being built; their parent indices match it.
+    QVector<FileIndex::DirEntries> takeBatch();
+    // Complete once finished() has been emitted.
+    FileIndex result() const;
+    FileIndex::ScanStats stats() const;
+
+signals:
+    void progress();
+    void finished();
+
+private slots:
+    void onProgress(int generation);
+    void onFinished(int generation);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<ScanJob> job;
+    int generation;
+    bool running;
+};
+
+#endif
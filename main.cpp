@@ -51,10 +51,40 @@
 #include <QApplication>
 #include <QCommandLineParser>
 
+#include "headless.h"
 #include "imageviewer.h"
+#include "trace.h"
+
+// The headless modes run on the offscreen platform, which has to be picked
+// before the application object exists, so argv is looked at directly.
+static bool isHeadless(int argc, char *argv[])
+{
+    static const char *const modes[] = { "--scan", "--render", "--bench" };
+    for (int i = 1; i < argc; ++i) {
+        const QByteArray argument(argv[i]);
+        for (const char *mode : modes) {
+            if (argument == mode || argument.startsWith(QByteArray(mode) + '='))
+                return true;
+        }
+    }
+    return false;
+}
+
+// "WxH" with both sides positive, or an invalid size.
+static QSize parseSize(const QString &text)
+{
+    const QStringList sides = text.split(QLatin1Char('x'));
+    bool widthOk = false;
+    bool heightOk = false;
+    const QSize size = sides.size() == 2
+        ? QSize(sides.at(0).toInt(&widthOk), sides.at(1).toInt(&heightOk)) : QSize();
+    return widthOk && heightOk && !size.isEmpty() ? size : QSize();
+}
 
 int main(int argc, char *argv[])
 {
+    if (isHeadless(argc, argv) && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
     QApplication app(argc, argv);
     QCoreApplication::setOrganizationName("FDev");
     QCoreApplication::setApplicationName("ImageViewer");
@@ -62,13 +92,58 @@ int main(int argc, char *argv[])
     QCommandLineParser commandLineParser;
     commandLineParser.addHelpOption();
     commandLineParser.addPositionalArgument(ImageViewer::tr("[file]"), ImageViewer::tr("Image file to open."));
+    QCommandLineOption traceOption("trace", ImageViewer::tr("Write a Chrome trace of recent timing spans to <file> on exit."),
+                                   ImageViewer::tr("file"));
+    if (Trace::isCompiledIn())
+        commandLineParser.addOption(traceOption);
+    QCommandLineOption scanOption("scan", ImageViewer::tr("Build or refresh the index of <dir>, print its stats and exit."),
+                                  ImageViewer::tr("dir"));
+    QCommandLineOption renderOption("render", ImageViewer::tr("Decode and scale <file> as for the window, write it to --out and exit."),
+                                    ImageViewer::tr("file"));
+    QCommandLineOption sizeOption("size", ImageViewer::tr("Window size for --render; as in the viewer, the height follows the image."), ImageViewer::tr("WxH"), "1280x800");
+    QCommandLineOption outOption("out", ImageViewer::tr("Output image for --render."), ImageViewer::tr("file"));
+    QCommandLineOption benchOption("bench", ImageViewer::tr("Time slideshow ticks over <dir>, print the timings and exit."),
+                                   ImageViewer::tr("dir"));
+    QCommandLineOption ticksOption("ticks", ImageViewer::tr("Ticks to time for --bench."), ImageViewer::tr("n"), "100");
+    QCommandLineOption tickGapOption("tick-gap", ImageViewer::tr("Milliseconds between ticks for --bench."),
+                                     ImageViewer::tr("ms"), "150");
+    commandLineParser.addOption(scanOption);
+    commandLineParser.addOption(renderOption);
+    commandLineParser.addOption(sizeOption);
+    commandLineParser.addOption(outOption);
+    commandLineParser.addOption(benchOption);
+    commandLineParser.addOption(ticksOption);
+    commandLineParser.addOption(tickGapOption);
     commandLineParser.process(QCoreApplication::arguments());
-    ImageViewer imageViewer;
-    if (!commandLineParser.positionalArguments().isEmpty()
-        && !imageViewer.loadFile(commandLineParser.positionalArguments().front())) {
-        return -1;
+
+    int status;
+    if (commandLineParser.isSet(scanOption)) {
+        status = Headless::scan(commandLineParser.value(scanOption));
+    } else if (commandLineParser.isSet(renderOption)) {
+        const QSize size = parseSize(commandLineParser.value(sizeOption));
+        if (!size.isValid() || !commandLineParser.isSet(outOption)) {
+            qWarning("--render needs --out <file> and a --size of WxH");
+            return 1;
+        }
+        status = Headless::render(commandLineParser.value(renderOption), size,
+                                  commandLineParser.value(outOption));
+    } else if (commandLineParser.isSet(benchOption)) {
+        status = Headless::bench(commandLineParser.value(benchOption),
+                                 qMax(1, commandLineParser.value(ticksOption).toInt()),
+                                 qMax(0, commandLineParser.value(tickGapOption).toInt()));
+    } else {
+        ImageViewer imageViewer;
+        if (!commandLineParser.positionalArguments().isEmpty()
+            && !imageViewer.loadFile(commandLineParser.positionalArguments().front())) {
+            return -1;
+        }
+        imageViewer.setWindowFlags(Qt::Window | Qt::FramelessWindowHint);
+        imageViewer.show();
+        status = app.exec();
+    }
+    if (Trace::isCompiledIn() && commandLineParser.isSet(traceOption)
+        && !Trace::save(commandLineParser.value(traceOption))) {
+        qWarning("Cannot write trace to %s", qPrintable(commandLineParser.value(traceOption)));
     }
-    imageViewer.setWindowFlags(Qt::Window | Qt::FramelessWindowHint);
-    imageViewer.show();
-    return app.exec();
+    return status;
 }
@@ -0,0 +1,136 @@
+#include <QAtomicInteger>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_DARWIN
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#endif
+
+#include "mappedfile.h"
+#include "trace.h"
+
+namespace {
+
+QAtomicInteger<qint64> fileCount;
+QAtomicInteger<qint64> mappedByteCount;
+QAtomicInteger<qint64> copiedByteCount;
+
+// Files changed more recently than this may still be being written.
+const int settledSecs = 60;
+
+bool isNetworkFile(const QFile &file)
+{
+#if defined(Q_OS_LINUX)
+    struct statfs fs;
+    if (fstatfs(file.handle(), &fs) != 0)
+        return true;
+    switch (quint32(fs.f_type)) {
+    case 0x6969u:     // NFS
+    case 0x517bu:     // SMB
+    case 0xff534d42u: // CIFS
+    case 0xfe534d42u: // SMB2
+    case 0x65735546u: // FUSE, e.g. sshfs
+    case 0x01021997u: // 9P
+    case 0x00c36400u: // Ceph
+    case 0x5346414fu: // AFS
+        return true;
+    default:
+        return false;
+    }
+#elif defined(Q_OS_DARWIN)
+    struct statfs fs;
+    return fstatfs(file.handle(), &fs) != 0 || !(fs.f_flags & MNT_LOCAL);
+#elif defined(Q_OS_WIN)
+    const QString path = QDir::toNativeSeparators(QFileInfo(file).absoluteFilePath());
+    if (path.startsWith(QLatin1String("\\\\")))
+        return true;
+    const QString root = path.left(3);
+    return GetDriveTypeW(reinterpret_cast<LPCWSTR>(root.utf16())) == DRIVE_REMOTE;
+#else
+    Q_UNUSED(file);
+    return false;
+#endif
+}
+
+bool isMappable(const QFile &file)
+{
+    const QDateTime modified = QFileInfo(file).lastModified();
+    return modified.secsTo(QDateTime::currentDateTime()) >= settledSecs
+        && !isNetworkFile(file);
+}
+
+} // namespace
+
+MappedFile::MappedFile(const QString &fileName, Advice advice)
+    : file(fileName)
+    , advice(advice)
+    , mapped(nullptr)
+{
+    TRACE_SPAN("MappedFile::open");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    // A QByteArray holds at most an int's worth of bytes.
+    const qint64 size = qMin<qint64>(file.size(), std::numeric_limits<int>::max() - 32);
+    if (size > 0 && isMappable(file))
+        mapped = file.map(0, size);
+    if (mapped) {
+        bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), int(size));
+        mappedByteCount.fetchAndAddRelaxed(size);
+    } else {
+        // One read of the whole file instead of QFile's buffered chunks.
+        bytes.resize(int(size));
+        const qint64 got = file.read(bytes.data(), size);
+        bytes.resize(int(qMax<qint64>(0, got)));
+        copiedByteCount.fetchAndAddRelaxed(bytes.size());
+    }
+    fileCount.fetchAndAddRelaxed(1);
+    buffer.setBuffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+}
+
+MappedFile::~MappedFile()
+{
+    buffer.close();
+    if (mapped)
+        file.unmap(mapped);
+#ifdef Q_OS_LINUX
+    if (advice == DropWhenDone && file.isOpen())
+        posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+void MappedFile::willNeed(const QString &fileName)
+{
+#ifdef Q_OS_LINUX
+    TRACE_SPAN("MappedFile::willNeed");
+    // Starts asynchronous readahead of the whole file.
+    const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    Q_UNUSED(fileName);
+#endif
+}
+
+MappedFile::Stats MappedFile::stats()
+{
+    Stats stats;
+    stats.files = fileCount.load();
+    stats.mappedBytes = mappedByteCount.load();
+    stats.copiedBytes = copiedByteCount.load();
+    return stats;
+}
@@ -0,0 +1,58 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+// A whole image file as one block of memory, handed to QImageReader as a
+// QBuffer. The file is mapped where possible, so its bytes go from the
+// page cache straight to the decoder; otherwise it is read with a single
+// read into a buffer of the file's size. The bytes behind each are
+// counted, see stats().
+//
+// A mapping is only as good as the file under it. If the file shrinks
+// while it is mapped, reading past the new end raises SIGBUS on Unix, and
+// a failing network read raises an in-page error on Windows; either kills
+// the process. So files on network filesystems, and files modified in the
+// last minute, as when they are still being copied in, are read instead.
+// A local file truncated in place after that is still a hazard.
+//
+// On Linux the kernel is also told what to expect: willNeed() starts
+// readahead for a file that is queued for display, and DropWhenDone lets
+// the pages go once the file is decoded, so a long slideshow does not push
+// everything else out of the page cache.
+class MappedFile
+{
+public:
+    enum Advice { KeepCached, DropWhenDone };
+    struct Stats {
+        qint64 files;
+        qint64 mappedBytes;
+        qint64 copiedBytes;
+    };
+
+    explicit MappedFile(const QString &fileName, Advice advice = KeepCached);
+    ~MappedFile();
+
+    bool isOpen() const { return buffer.isOpen(); }
+    bool isMapped() const { return mapped != nullptr; }
+    QString errorString() const { return file.errorString(); }
+    // Reads the file's bytes; valid while this object lives.
+    QIODevice *device() { return &buffer; }
+
+    static void willNeed(const QString &fileName);
+    static Stats stats();
+
+private:
+    Q_DISABLE_COPY(MappedFile)
+
+    QFile file;
+    Advice advice;
+    uchar *mapped;
+    QByteArray bytes;
+    QBuffer buffer;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "shufflebag.h"
+
+namespace {
+
+// MurmurHash3's finalizer.
+quint32 mix(quint32 h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+} // namespace
+
+ShuffleBag::ShuffleBag()
+{
+    reset(0, 0);
+}
+
+void ShuffleBag::reset(quint32 count, quint32 seed, quint32 position)
+{
+    n = count;
+    pos = qMin(position, count);
+    key = seed;
+    // The permuted domain is 4^halfBits, less than four times count, so
+    // the walk back into range takes under four steps on average.
+    halfBits = 1;
+    while (halfBits < 16 && (quint64(1) << (2 * halfBits)) < count)
+        halfBits++;
+    halfMask = (1u << halfBits) - 1;
+    for (int i = 0; i < 4; ++i)
+        roundKeys[i] = mix(seed + quint32(i) * 0x9e3779b9u);
+}
+
+bool ShuffleBag::next(quint32 *value)
+{
+    if (pos >= n)
+        return false;
+    quint32 x = permute(pos++);
+    while (x >= n)
+        x = permute(x);
+    *value = x;
+    return true;
+}
+
+quint32 ShuffleBag::permute(quint32 x) const
+{
+    quint32 left = x >> halfBits;
+    quint32 right = x & halfMask;
+    for (int i = 0; i < 4; ++i) {
+        const quint32 next = left ^ (mix(right ^ roundKeys[i]) & halfMask);
+        left = right;
+        right = next;
+    }
+    return (left << halfBits) | right;
+}
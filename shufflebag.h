@@ -0,0 +1,37 @@
+#ifndef SHUFFLEBAG_H
+#define SHUFFLEBAG_H
+
+#include <QtGlobal>
+
+// Visits 0 .. count - 1 exactly once each, in an order that looks random,
+// without ever holding the order in memory. The i-th value is a keyed
+// Feistel permutation of i over the next power of four, cycle-walked back
+// into range, so each step costs a few hashes and the state is just the
+// seed and the position.
+class ShuffleBag
+{
+public:
+    ShuffleBag();
+
+    // Start a new pass; the seed picks the order. A pass saved from
+    // count(), seed() and position() resumes where it was.
+    void reset(quint32 count, quint32 seed, quint32 position = 0);
+    // Next value of the pass, or false once every value has been handed out.
+    bool next(quint32 *value);
+
+    quint32 count() const { return n; }
+    quint32 position() const { return pos; }
+    quint32 seed() const { return key; }
+
+private:
+    quint32 permute(quint32 x) const;
+
+    quint32 n;
+    quint32 pos;
+    quint32 key;
+    int halfBits;
+    quint32 halfMask;
+    quint32 roundKeys[4];
+};
+
+#endif
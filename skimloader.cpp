@@ -0,0 +1,223 @@
+#include <QAtomicInt>
+#include <QIODevice>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include "displaymirror.h"
+#include "fileindex.h"
+#include "mappedfile.h"
+#include "skimloader.h"
+#include "trace.h"
+
+namespace {
+
+struct SkimRequest {
+    int generation;
+    QString fileName;
+    QSize targetSize;
+    bool proxy;
+    QString mirrorRoot;
+};
+
+} // namespace
+
+struct SkimJob
+{
+    explicit SkimJob(SkimLoader *loader)
+        : loader(loader), generation(0), superseded(0), cancelled(0)
+        , hasPending(false), running(false) {}
+
+    // Take the request waiting to start, or retire the worker.
+    bool take(SkimRequest *request)
+    {
+        QMutexLocker locker(&mutex);
+        if (!hasPending) {
+            running = false;
+            return false;
+        }
+        *request = pending;
+        hasPending = false;
+        return true;
+    }
+
+    SkimLoader *loader;
+    QAtomicInt generation;  // of the latest request; anything older is stale
+    QAtomicInt superseded;
+    QAtomicInt cancelled;
+
+    QMutex mutex;           // guards everything below
+    SkimRequest pending;
+    bool hasPending;
+    bool running;           // a worker is on the job
+};
+
+namespace {
+
+// Reads through to source until the request it serves is stale, then
+// fails every read.
+class StaleCheckDevice : public QIODevice
+{
+public:
+    StaleCheckDevice(QIODevice *source, const QAtomicInt &latest, int generation)
+        : m_source(source), m_latest(latest), m_generation(generation)
+    {
+        // Unbuffered, so each of the reader's reads is checked.
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return m_source->size(); }
+    bool seek(qint64 pos) override { return QIODevice::seek(pos) && m_source->seek(pos); }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        if (m_latest.load() != m_generation)
+            return -1;
+        return m_source->read(data, maxSize);
+    }
+
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QIODevice *m_source;
+    const QAtomicInt &m_latest;
+    const int m_generation;
+};
+
+ImageLoader::Frame decode(const SkimJob &job, const SkimRequest &request)
+{
+    ImageLoader::Frame frame;
+    if (!request.mirrorRoot.isEmpty()
+        && DisplayMirror::decode(request.mirrorRoot, request.fileName, request.targetSize, &frame)) {
+        return frame;
+    }
+    const qint64 mtime = FileIndex::modificationTime(request.fileName);
+    // Kept cached: a proxy is followed by the full decode of the same file.
+    MappedFile source(request.fileName);
+    if (!source.isOpen()) {
+        frame.errorString = source.errorString();
+        return frame;
+    }
+    StaleCheckDevice device(source.device(), job.generation, request.generation);
+    frame = ImageLoader::decode(&device, request.targetSize);
+    frame.mtime = mtime;
+    return frame;
+}
+
+class SkimWorker : public QRunnable
+{
+public:
+    explicit SkimWorker(const QSharedPointer<SkimJob> &job) : m_job(job) {}
+
+    void run() override
+    {
+        SkimRequest request;
+        while (m_job->take(&request)) {
+            TRACE_SPAN("SkimLoader::decode");
+            const ImageLoader::Frame frame = decode(*m_job, request);
+            // A reader cut off by the device may still return what it
+            // had, so staleness is decided here rather than by the error.
+            if (m_job->generation.load() != request.generation) {
+                m_job->cancelled.ref();
+                continue;
+            }
+            QMetaObject::invokeMethod(m_job->loader, "onDecoded", Qt::QueuedConnection,
+                                      Q_ARG(int, request.generation),
+                                      Q_ARG(QString, request.fileName),
+                                      Q_ARG(bool, request.proxy),
+                                      Q_ARG(QImage, frame.image),
+                                      Q_ARG(QSize, frame.sourceSize),
+                                      Q_ARG(QString, frame.errorString),
+                                      Q_ARG(qint64, frame.mtime));
+        }
+    }
+
+private:
+    QSharedPointer<SkimJob> m_job;
+};
+
+} // namespace
+
+SkimLoader::SkimLoader(QObject *parent)
+    : QObject(parent)
+    , job(new SkimJob(this))
+    , hasFrame(false)
+    , requestCount(0)
+    , decodedCount(0)
+{
+    // Decodes are strictly one after the other; a second thread would
+    // only let a stale one compete with the latest.
+    pool.setMaxThreadCount(1);
+}
+
+SkimLoader::~SkimLoader()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void SkimLoader::setMirrorRoot(const QString &root)
+{
+    mirrorRoot = root;
+}
+
+void SkimLoader::request(const QString &fileName, const QSize &targetSize, bool proxy)
+{
+    requestCount++;
+    hasFrame = false;
+    QMutexLocker locker(&job->mutex);
+    if (job->hasPending)
+        job->superseded.ref();
+    const int generation = job->generation.fetchAndAddOrdered(1) + 1;
+    job->pending = SkimRequest{ generation, fileName, targetSize, proxy, mirrorRoot };
+    job->hasPending = true;
+    if (!job->running) {
+        job->running = true;
+        pool.start(new SkimWorker(job));
+    }
+}
+
+void SkimLoader::cancel()
+{
+    hasFrame = false;
+    QMutexLocker locker(&job->mutex);
+    job->hasPending = false;
+    job->generation.ref();
+}
+
+bool SkimLoader::take(ImageLoader::Frame *frame)
+{
+    if (!hasFrame)
+        return false;
+    *frame = this->frame;
+    this->frame = ImageLoader::Frame();
+    hasFrame = false;
+    return true;
+}
+
+SkimLoader::Stats SkimLoader::stats() const
+{
+    Stats stats;
+    stats.requested = requestCount;
+    stats.decoded = decodedCount;
+    stats.superseded = job->superseded.load();
+    stats.cancelled = job->cancelled.load();
+    return stats;
+}
+
+void SkimLoader::onDecoded(int generation, const QString &fileName, bool proxy, const QImage &image,
+                           const QSize &sourceSize, const QString &errorString, qint64 mtime)
+{
+    if (generation != job->generation.load())
+        return;
+    decodedCount++;
+    frame.image = image;
+    frame.sourceSize = sourceSize;
+    frame.errorString = errorString;
+    frame.mtime = mtime;
+    hasFrame = true;
+    emit frameReady(fileName, proxy);
+}
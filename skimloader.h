@@ -0,0 +1,62 @@
+#ifndef SKIMLOADER_H
+#define SKIMLOADER_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+
+#include "imageloader.h"
+
+struct SkimJob;
+
+// Decodes the one file the user is stepping to, latest request wins. A
+// request replaces the one waiting to start, so no more than one frame is
+// ever queued, and makes the decode in flight stale: its reads start
+// failing, which makes the reader give up partway through the file, and
+// whatever it returns is thrown away. Only the latest result is kept.
+//
+// Proxies are decoded at a reduced width, which a JPEG reader does for a
+// fraction of the full cost by scaling in the DCT.
+class SkimLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        int requested;
+        int decoded;
+        int superseded; // replaced before they started
+        int cancelled;  // went stale while decoding
+    };
+
+    explicit SkimLoader(QObject *parent = nullptr);
+    ~SkimLoader();
+
+    // Read from the DisplayMirror of root where it is up to date.
+    void setMirrorRoot(const QString &root);
+    void request(const QString &fileName, const QSize &targetSize, bool proxy);
+    void cancel();
+    // Hand over the frame announced by frameReady().
+    bool take(ImageLoader::Frame *frame);
+    Stats stats() const;
+
+signals:
+    void frameReady(const QString &fileName, bool proxy);
+
+private slots:
+    void onDecoded(int generation, const QString &fileName, bool proxy, const QImage &image,
+                   const QSize &sourceSize, const QString &errorString, qint64 mtime);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<SkimJob> job;
+    QString mirrorRoot;
+    bool hasFrame;
+    ImageLoader::Frame frame;
+    int requestCount;
+    int decodedCount;
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+#include <QDebug>
+
+#include "downscaler.h"
+#include "imageloader.h"
+#include "thumbnailcache.h"
+#include "trace.h"
+
+struct ThumbnailQueue
+{
+    ThumbnailQueue(ThumbnailCache *cache, int pixelSize)
+        : cache(cache), pixelSize(pixelSize), workers(0) {}
+
+    // Move the next request to started, or retire the calling worker.
+    bool take(ThumbnailCache::Request *request)
+    {
+        QMutexLocker locker(&mutex);
+        if (requests.isEmpty()) {
+            workers--;
+            return false;
+        }
+        *request = requests.takeFirst();
+        started.insert(request->fileName);
+        return true;
+    }
+
+    ThumbnailCache *cache;
+    const int pixelSize;
+
+    QMutex mutex;       // guards everything below
+    QList<ThumbnailCache::Request> requests;
+    QSet<QString> started;
+    int workers;        // workers that have not exited yet
+};
+
+namespace {
+
+class ThumbnailTask : public QRunnable
+{
+public:
+    explicit ThumbnailTask(const QSharedPointer<ThumbnailQueue> &queue) : m_queue(queue) {}
+
+    void run() override
+    {
+        ThumbnailCache::Request request;
+        while (m_queue->take(&request)) {
+            bool generated = false;
+            const QImage image = Downscaler::toDisplayFormat(
+                ThumbnailCache::load(request.fileName, request.mtime, m_queue->pixelSize, &generated));
+            // The cache waits for the pool in its destructor.
+            QMetaObject::invokeMethod(m_queue->cache, "onLoaded", Qt::QueuedConnection,
+                                      Q_ARG(QString, request.fileName),
+                                      Q_ARG(QImage, image),
+                                      Q_ARG(bool, generated));
+        }
+    }
+
+private:
+    QSharedPointer<ThumbnailQueue> m_queue;
+};
+
+QString flavour(int pixelSize)
+{
+    return pixelSize > 128 ? QStringLiteral("large") : QStringLiteral("normal");
+}
+
+int flavourSize(int pixelSize)
+{
+    return pixelSize > 128 ? 256 : 128;
+}
+
+QByteArray fileUri(const QString &fileName)
+{
+    return QUrl::fromLocalFile(fileName).toEncoded();
+}
+
+} // namespace
+
+ThumbnailCache::ThumbnailCache(int pixelSize, QObject *parent)
+    : QObject(parent)
+    , size(flavourSize(pixelSize))
+    , loadedCount(0)
+    , generatedCount(0)
+{
+    pool.setMaxThreadCount(2);
+    queue = QSharedPointer<ThumbnailQueue>(new ThumbnailQueue(this, size));
+    setMemoryBudget(64);
+    // The spec wants the directories private to the user.
+    const QString dir = cacheDir(size);
+    if (QDir().mkpath(dir)) {
+        QFile::setPermissions(QFileInfo(dir).absolutePath(), QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+        QFile::setPermissions(dir, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+    }
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    {
+        QMutexLocker locker(&queue->mutex);
+        queue->requests.clear();
+    }
+    pool.waitForDone();
+}
+
+void ThumbnailCache::setMaxThreads(int count)
+{
+    pool.setMaxThreadCount(qMax(1, count));
+}
+
+int ThumbnailCache::maxThreads() const
+{
+    return pool.maxThreadCount();
+}
+
+void ThumbnailCache::setMemoryBudget(int megabytes)
+{
+    pixmaps.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+QPixmap ThumbnailCache::cached(const QString &fileName) const
+{
+    const QPixmap *pixmap = pixmaps.object(fileName);
+    return pixmap ? *pixmap : QPixmap();
+}
+
+void ThumbnailCache::want(const QVector<Request> &requests)
+{
+    QMutexLocker locker(&queue->mutex);
+    queue->requests.clear();
+    foreach (const Request &request, requests) {
+        if (!pixmaps.contains(request.fileName) && !failed.contains(request.fileName)
+            && !queue->started.contains(request.fileName))
+            queue->requests.append(request);
+    }
+    while (queue->workers < qMin(pool.maxThreadCount(), queue->requests.size())) {
+        queue->workers++;
+        pool.start(new ThumbnailTask(queue));
+    }
+}
+
+ThumbnailCache::Stats ThumbnailCache::stats() const
+{
+    Stats stats;
+    stats.loaded = loadedCount;
+    stats.generated = generatedCount;
+    stats.failed = failed.size();
+    stats.pixmaps = pixmaps.count();
+    stats.bytes = qint64(pixmaps.totalCost()) * 1024;
+    return stats;
+}
+
+QString ThumbnailCache::cacheDir(int pixelSize)
+{
+    // GenericCacheLocation is $XDG_CACHE_HOME (~/.cache) on Linux.
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/thumbnails/") + flavour(pixelSize);
+}
+
+QString ThumbnailCache::thumbnailPath(const QString &fileName, int pixelSize)
+{
+    const QByteArray md5 = QCryptographicHash::hash(fileUri(fileName), QCryptographicHash::Md5).toHex();
+    return cacheDir(pixelSize) + QLatin1Char('/') + QString::fromLatin1(md5) + QStringLiteral(".png");
+}
+
+QImage ThumbnailCache::load(const QString &fileName, qint64 mtime, int pixelSize, bool *generated)
+{
+    TRACE_SPAN("ThumbnailCache::load");
+    const int side = flavourSize(pixelSize);
+    const QString path = thumbnailPath(fileName, side);
+    const QString uri = QString::fromLatin1(fileUri(fileName));
+    const QString mtimeText = QString::number(mtime / 1000);
+    *generated = false;
+    {
+        QImageReader reader(path);
+        const QImage stored = reader.read();
+        if (!stored.isNull() && stored.text(QStringLiteral("Thumb::URI")) == uri
+            && stored.text(QStringLiteral("Thumb::MTime")) == mtimeText)
+            return stored;
+    }
+
+    // Let the reader scale while decoding, then box filter to fit.
+    const ImageLoader::Frame frame = ImageLoader::decode(fileName, QSize(side, side));
+    if (frame.image.isNull())
+        return QImage();
+    QImage thumbnail = frame.image;
+    if (thumbnail.width() > side || thumbnail.height() > side)
+        thumbnail = Downscaler::scale(thumbnail, thumbnail.size().scaled(side, side, Qt::KeepAspectRatio));
+    thumbnail.setText(QStringLiteral("Thumb::URI"), uri);
+    thumbnail.setText(QStringLiteral("Thumb::MTime"), mtimeText);
+    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(frame.sourceSize.width()));
+    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(frame.sourceSize.height()));
+    thumbnail.setText(QStringLiteral("Software"), QCoreApplication::applicationName());
+
+    // QSaveFile writes a temporary file and renames it, as the spec asks.
+    QSaveFile out(path);
+    QImageWriter writer(&out, "png");
+    if (!out.open(QIODevice::WriteOnly) || !writer.write(thumbnail) || !out.commit())
+        qDebug() << "Cannot store thumbnail" << path << writer.errorString();
+    *generated = true;
+    return thumbnail;
+}
+
+void ThumbnailCache::onLoaded(const QString &fileName, const QImage &image, bool generated)
+{
+    {
+        QMutexLocker locker(&queue->mutex);
+        queue->started.remove(fileName);
+    }
+    if (image.isNull()) {
+        failed.insert(fileName);
+    } else {
+        if (generated)
+            generatedCount++;
+        else
+            loadedCount++;
+        const int cost = int((qint64(image.width()) * image.height() * 4 + 1023) / 1024);
+        pixmaps.insert(fileName, new QPixmap(QPixmap::fromImage(image)), cost);
+    }
+    emit thumbnailReady(fileName);
+}
@@ -0,0 +1,81 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QCache>
+#include <QObject>
+#include <QPixmap>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+struct ThumbnailQueue;
+
+// Thumbnails kept on disk in the freedesktop.org layout, shared with file
+// managers: $XDG_CACHE_HOME/thumbnails/normal (128 px) or large (256 px),
+// one PNG per file named after the MD5 of its URI and tagged with its
+// modification time. Missing or stale ones are generated on a worker
+// pool. Loaded thumbnails are held as pixmaps in an LRU cache with a byte
+// budget.
+//
+// want() replaces the whole queue, so whatever the view asks for last is
+// loaded first and files scrolled out of view are dropped before they are
+// started.
+class ThumbnailCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Request {
+        QString fileName;
+        qint64 mtime;   // ms since epoch, as in FileIndex
+    };
+    struct Stats {
+        int loaded;     // read from the disk cache
+        int generated;  // decoded from the image and stored
+        int failed;
+        int pixmaps;
+        qint64 bytes;
+    };
+
+    // pixelSize above 128 picks the large flavour.
+    explicit ThumbnailCache(int pixelSize = 128, QObject *parent = nullptr);
+    ~ThumbnailCache();
+
+    void setMaxThreads(int count);
+    int maxThreads() const;
+    void setMemoryBudget(int megabytes);
+    int pixelSize() const { return size; }
+
+    // The thumbnail if it is in memory, or a null pixmap.
+    QPixmap cached(const QString &fileName) const;
+    bool hasFailed(const QString &fileName) const { return failed.contains(fileName); }
+    // Load requests in order, dropping whatever was queued before.
+    // Thumbnails in memory or already being loaded are skipped.
+    void want(const QVector<Request> &requests);
+    Stats stats() const;
+
+    static QString cacheDir(int pixelSize);
+    static QString thumbnailPath(const QString &fileName, int pixelSize);
+    // Read the stored thumbnail of fileName, or generate and store it if
+    // there is none for this mtime. Safe to call from any thread.
+    static QImage load(const QString &fileName, qint64 mtime, int pixelSize, bool *generated);
+
+signals:
+    void thumbnailReady(const QString &fileName);
+
+private slots:
+    void onLoaded(const QString &fileName, const QImage &image, bool generated);
+
+private:
+    QThreadPool pool;
+    QSharedPointer<ThumbnailQueue> queue;
+    int size;
+    QCache<QString, QPixmap> pixmaps; // cost in KB
+    QSet<QString> failed;
+    int loadedCount;
+    int generatedCount;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+
+#include "thumbnailcache.h"
+#include "thumbnailgrid.h"
+#include "trace.h"
+
+namespace {
+
+// Space around each thumbnail inside its cell.
+const int cellMargin = 4;
+
+} // namespace
+
+ThumbnailGrid::ThumbnailGrid(ThumbnailCache *cache, QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , thumbnails(cache)
+    , current(-1)
+    , firstRequested(0)
+    , lastRequested(-1)
+{
+    setFocusPolicy(Qt::StrongFocus);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    viewport()->setBackgroundRole(QPalette::Dark);
+    viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
+    connect(thumbnails, &ThumbnailCache::thumbnailReady, this, &ThumbnailGrid::thumbnailReady);
+}
+
+void ThumbnailGrid::setFiles(const FileIndex &newIndex)
+{
+    index = newIndex;
+    ids.clear();
+    ids.reserve(index.fileCount());
+    for (quint32 id = 0; id < index.idCount(); ++id) {
+        if (index.isLive(id))
+            ids.append(id);
+    }
+    current = ids.isEmpty() ? -1 : 0;
+    firstRequested = 0;
+    lastRequested = -1;
+    verticalScrollBar()->setValue(0);
+    updateScrollBars();
+    requestVisible();
+    viewport()->update();
+}
+
+void ThumbnailGrid::setCurrent(const QString &fileName)
+{
+    const qint64 id = index.findFile(fileName);
+    if (id < 0)
+        return;
+    // ids is sorted, being built in id order.
+    const QVector<quint32>::const_iterator it = std::lower_bound(ids.constBegin(), ids.constEnd(), quint32(id));
+    if (it != ids.constEnd() && *it == quint32(id))
+        moveCurrent(int(it - ids.constBegin()));
+}
+
+QString ThumbnailGrid::currentFile() const
+{
+    return current >= 0 ? index.filePath(ids.at(current)) : QString();
+}
+
+int ThumbnailGrid::cellSize() const
+{
+    return thumbnails->pixelSize() + 2 * cellMargin;
+}
+
+int ThumbnailGrid::columnCount() const
+{
+    return qMax(1, viewport()->width() / cellSize());
+}
+
+QRect ThumbnailGrid::cellRect(int cell) const
+{
+    const int size = cellSize();
+    const int columns = columnCount();
+    // Centre the columns in the viewport.
+    const int left = qMax(0, (viewport()->width() - columns * size) / 2);
+    return QRect(left + (cell % columns) * size, (cell / columns) * size - verticalScrollBar()->value(),
+                 size, size);
+}
+
+int ThumbnailGrid::cellAt(const QPoint &pos) const
+{
+    const int size = cellSize();
+    const int columns = columnCount();
+    const int left = qMax(0, (viewport()->width() - columns * size) / 2);
+    const int column = (pos.x() - left) / size;
+    if (pos.x() < left || column >= columns)
+        return -1;
+    const int cell = ((pos.y() + verticalScrollBar()->value()) / size) * columns + column;
+    return cell < ids.size() ? cell : -1;
+}
+
+void ThumbnailGrid::updateScrollBars()
+{
+    const int size = cellSize();
+    const int rows = (ids.size() + columnCount() - 1) / columnCount();
+    verticalScrollBar()->setRange(0, qMax(0, rows * size - viewport()->height()));
+    verticalScrollBar()->setPageStep(viewport()->height());
+    verticalScrollBar()->setSingleStep(size / 2);
+}
+
+// Queue the visible cells, then a screen below and a screen above them.
+void ThumbnailGrid::requestVisible()
+{
+    if (ids.isEmpty())
+        return;
+    const int size = cellSize();
+    const int columns = columnCount();
+    const int top = verticalScrollBar()->value();
+    const int firstRow = top / size;
+    const int lastRow = (top + viewport()->height()) / size;
+    const int first = firstRow * columns;
+    const int last = qMin(ids.size() - 1, (lastRow + 1) * columns - 1);
+    if (first == firstRequested && last == lastRequested)
+        return;
+    firstRequested = first;
+    lastRequested = last;
+
+    const int margin = last - first + 1;
+    QVector<ThumbnailCache::Request> requests;
+    requests.reserve(3 * margin);
+    auto append = [&](int cell) {
+        ThumbnailCache::Request request;
+        request.fileName = index.filePath(ids.at(cell));
+        request.mtime = index.fileAt(ids.at(cell)).mtime;
+        requests.append(request);
+    };
+    for (int cell = first; cell <= last; ++cell)
+        append(cell);
+    for (int cell = last + 1; cell <= qMin(ids.size() - 1, last + margin); ++cell)
+        append(cell);
+    for (int cell = first - 1; cell >= qMax(0, first - margin); --cell)
+        append(cell);
+    thumbnails->want(requests);
+}
+
+void ThumbnailGrid::moveCurrent(int cell)
+{
+    if (ids.isEmpty())
+        return;
+    cell = qBound(0, cell, ids.size() - 1);
+    const QRect before = cellRect(current);
+    current = cell;
+    const QRect rect = cellRect(current);
+    if (rect.top() < 0)
+        verticalScrollBar()->setValue(verticalScrollBar()->value() + rect.top());
+    else if (rect.bottom() >= viewport()->height())
+        verticalScrollBar()->setValue(verticalScrollBar()->value() + rect.bottom() - viewport()->height() + 1);
+    viewport()->update(before);
+    viewport()->update(cellRect(current));
+}
+
+void ThumbnailGrid::paintEvent(QPaintEvent *event)
+{
+    TRACE_SPAN("ThumbnailGrid::paint");
+    QPainter painter(viewport());
+    const QRect exposed = event->rect();
+    painter.fillRect(exposed, viewport()->palette().brush(QPalette::Dark));
+    if (ids.isEmpty())
+        return;
+
+    const int size = cellSize();
+    const int columns = columnCount();
+    const int top = verticalScrollBar()->value();
+    const int firstRow = (top + exposed.top()) / size;
+    const int lastRow = (top + exposed.bottom()) / size;
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            const int cell = row * columns + column;
+            if (cell >= ids.size())
+                return;
+            const QRect rect = cellRect(cell);
+            if (!rect.intersects(exposed))
+                continue;
+            if (cell == current)
+                painter.fillRect(rect, palette().brush(QPalette::Highlight));
+            const QRect box = rect.adjusted(cellMargin, cellMargin, -cellMargin, -cellMargin);
+            const QString fileName = index.filePath(ids.at(cell));
+            const QPixmap pixmap = thumbnails->cached(fileName);
+            if (!pixmap.isNull()) {
+                QRect target(QPoint(0, 0), pixmap.size() / pixmap.devicePixelRatio());
+                if (target.width() > box.width() || target.height() > box.height())
+                    target.setSize(target.size().scaled(box.size(), Qt::KeepAspectRatio));
+                target.moveCenter(box.center());
+                painter.drawPixmap(target, pixmap);
+            } else if (thumbnails->hasFailed(fileName)) {
+                painter.setPen(palette().color(QPalette::Mid));
+                painter.drawLine(box.topLeft(), box.bottomRight());
+                painter.drawLine(box.topRight(), box.bottomLeft());
+            } else {
+                painter.fillRect(box.adjusted(box.width() / 4, box.height() / 4,
+                                              -box.width() / 4, -box.height() / 4),
+                                 palette().brush(QPalette::Mid));
+            }
+        }
+    }
+}
+
+void ThumbnailGrid::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+    requestVisible();
+}
+
+void ThumbnailGrid::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx);
+    // Only the newly exposed strip is painted.
+    viewport()->scroll(0, dy);
+    requestVisible();
+}
+
+void ThumbnailGrid::thumbnailReady(const QString &fileName)
+{
+    Q_UNUSED(fileName);
+    // Repaints are coalesced, so a burst of thumbnails costs one paint.
+    viewport()->update();
+}
+
+void ThumbnailGrid::mousePressEvent(QMouseEvent *event)
+{
+    const int cell = cellAt(event->pos());
+    if (cell >= 0)
+        moveCurrent(cell);
+    event->accept();
+}
+
+void ThumbnailGrid::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    const int cell = cellAt(event->pos());
+    if (cell >= 0)
+        emit activated(index.filePath(ids.at(cell)));
+    event->accept();
+}
+
+void ThumbnailGrid::keyPressEvent(QKeyEvent *event)
+{
+    const int columns = columnCount();
+    const int rowsPerPage = qMax(1, viewport()->height() / cellSize());
+    switch (event->key()) {
+    case Qt::Key_Left:
+        moveCurrent(current - 1);
+        break;
+    case Qt::Key_Right:
+        moveCurrent(current + 1);
+        break;
+    case Qt::Key_Up:
+        moveCurrent(current - columns);
+        break;
+    case Qt::Key_Down:
+        moveCurrent(current + columns);
+        break;
+    case Qt::Key_PageUp:
+        moveCurrent(current - rowsPerPage * columns);
+        break;
+    case Qt::Key_PageDown:
+        moveCurrent(current + rowsPerPage * columns);
+        break;
+    case Qt::Key_Home:
+        moveCurrent(0);
+        break;
+    case Qt::Key_End:
+        moveCurrent(ids.size() - 1);
+        break;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        if (current >= 0)
+            emit activated(currentFile());
+        break;
+    case Qt::Key_Escape:
+        emit closeRequested();
+        break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+        return;
+    }
+    event->accept();
+}
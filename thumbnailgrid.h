@@ -0,0 +1,63 @@
+#ifndef THUMBNAILGRID_H
+#define THUMBNAILGRID_H
+
+#include <QAbstractScrollArea>
+#include <QVector>
+
+#include "fileindex.h"
+
+class ThumbnailCache;
+
+// Browses the files of a FileIndex as a grid of thumbnails. Nothing is
+// held per cell: the visible rows are worked out from the scroll position
+// on every paint, drawn from the thumbnail cache, and whatever is missing
+// in and around them is queued, visible cells first.
+class ThumbnailGrid : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit ThumbnailGrid(ThumbnailCache *cache, QWidget *parent = nullptr);
+
+    // Show the live files of index in id order, which keeps folders
+    // together. The grid works on its own copy.
+    void setFiles(const FileIndex &index);
+    int count() const { return ids.size(); }
+    // Select fileName and scroll it into view.
+    void setCurrent(const QString &fileName);
+    QString currentFile() const;
+
+signals:
+    void activated(const QString &fileName);
+    // Escape was pressed.
+    void closeRequested();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+
+private slots:
+    void thumbnailReady(const QString &fileName);
+
+private:
+    int cellSize() const;
+    int columnCount() const;
+    int cellAt(const QPoint &pos) const;
+    QRect cellRect(int cell) const;
+    void updateScrollBars();
+    void requestVisible();
+    void moveCurrent(int cell);
+
+    ThumbnailCache *thumbnails;
+    FileIndex index;
+    QVector<quint32> ids;
+    int current;
+    int firstRequested; // cells last passed to the cache
+    int lastRequested;
+};
+
+#endif
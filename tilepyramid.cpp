@@ -0,0 +1,83 @@
+#include <QtMath>
+
+#include <cmath>
+
+#include "downscaler.h"
+#include "tilepyramid.h"
+#include "trace.h"
+
+namespace {
+
+quint64 tileKey(int level, int x, int y)
+{
+    return (quint64(level) << 56) | (quint64(quint32(y) & 0xfffffff) << 28) | (quint32(x) & 0xfffffff);
+}
+
+} // namespace
+
+TilePyramid::TilePyramid(int cacheMegabytes)
+    : built(0)
+{
+    setCacheBudget(cacheMegabytes);
+}
+
+void TilePyramid::setImage(const QImage &image)
+{
+    source = image;
+    // Tiles are read straight out of the image's bits.
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32_Premultiplied)
+        source = source.convertToFormat(source.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                                  : QImage::Format_RGB32);
+    tiles.clear();
+}
+
+void TilePyramid::setCacheBudget(int megabytes)
+{
+    tiles.setMaxCost(qMax(1, megabytes) * 1024);
+}
+
+int TilePyramid::levelFor(double scale) const
+{
+    if (scale >= 1.0 || scale <= 0.0)
+        return 0;
+    int level = qFloor(std::log2(1.0 / scale));
+    // Stop where the whole image is a single pixel.
+    while (level > 0 && (source.width() >> level) == 0 && (source.height() >> level) == 0)
+        level--;
+    return level;
+}
+
+QSize TilePyramid::levelSize(int level) const
+{
+    const int f = 1 << level;
+    return QSize((source.width() + f - 1) / f, (source.height() + f - 1) / f);
+}
+
+QRect TilePyramid::tileRect(int level, int x, int y) const
+{
+    return QRect(x * TileSize, y * TileSize, TileSize, TileSize)
+        .intersected(QRect(QPoint(0, 0), levelSize(level)));
+}
+
+QPixmap TilePyramid::tile(int level, int x, int y)
+{
+    const quint64 key = tileKey(level, x, y);
+    if (QPixmap *cached = tiles.object(key))
+        return *cached;
+
+    TRACE_SPAN("TilePyramid::tile");
+    const QRect rect = tileRect(level, x, y);
+    if (rect.isEmpty())
+        return QPixmap();
+    const int f = 1 << level;
+    const QRect area = QRect(rect.topLeft() * f, rect.size() * f).intersected(source.rect());
+    // A view on the source's bits, so only the tile itself is allocated.
+    const QImage region(source.constBits() + qint64(area.y()) * source.bytesPerLine() + area.x() * 4,
+                        area.width(), area.height(), source.bytesPerLine(), source.format());
+    const QImage scaled = area.size() == rect.size() ? region.copy() : Downscaler::scale(region, rect.size());
+    const QPixmap pixmap = QPixmap::fromImage(scaled);
+    built++;
+    const int cost = int((qint64(rect.width()) * rect.height() * 4 + 1023) / 1024);
+    tiles.insert(key, new QPixmap(pixmap), cost);
+    return pixmap;
+}
@@ -0,0 +1,41 @@
+#ifndef TILEPYRAMID_H
+#define TILEPYRAMID_H
+
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+#include <QRect>
+
+// Square tiles of an image at power-of-two reductions, built on demand
+// and kept in an LRU cache with a byte budget. Level 0 is the image
+// itself; a tile of level n is box-filtered straight from the 2^n times
+// larger area of level 0, so no reduced copy of the whole image is ever
+// held.
+class TilePyramid
+{
+public:
+    enum { TileSize = 256 };
+
+    explicit TilePyramid(int cacheMegabytes = 64);
+
+    void setImage(const QImage &image);
+    QImage image() const { return source; }
+    void setCacheBudget(int megabytes);
+
+    // Coarsest level that still has at least scale pixels per source pixel.
+    int levelFor(double scale) const;
+    QSize levelSize(int level) const;
+    // Tile (x, y) of level in that level's pixels; clipped at the edges.
+    QRect tileRect(int level, int x, int y) const;
+    QPixmap tile(int level, int x, int y);
+
+    int tilesBuilt() const { return built; }
+    int tilesCached() const { return tiles.count(); }
+
+private:
+    QImage source;
+    QCache<quint64, QPixmap> tiles; // cost in KB
+    int built;
+};
+
+#endif
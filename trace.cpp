@@ -0,0 +1,173 @@
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+#include <QVector>
+
+#include "trace.h"
+
+namespace {
+
+const quint64 eventsPerThread = 16384; // a power of two
+
+struct Event {
+    const char *name;
+    qint64 start;
+    qint64 duration;
+};
+
+// Written only by its thread. The count is published with release order
+// so a reader sees complete events below it.
+struct ThreadBuffer {
+    int tid;
+    QString threadName;
+    QAtomicInteger<quint64> written;
+    Event events[eventsPerThread];
+};
+
+// Buffers are handed back when their thread exits and reused by the next
+// new thread, so the pools' expiring threads do not grow the trace. What a
+// finished thread recorded stays visible until it is overwritten.
+struct Registry {
+    Registry() { clock.start(); }
+
+    QMutex mutex;
+    QVector<ThreadBuffer *> buffers;
+    QVector<ThreadBuffer *> idle;
+    QElapsedTimer clock;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+QString currentThreadName()
+{
+    QThread *thread = QThread::currentThread();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+        return QStringLiteral("GUI");
+    return thread->objectName();
+}
+
+struct LocalBuffer {
+    ThreadBuffer *buffer = nullptr;
+
+    ~LocalBuffer()
+    {
+        if (!buffer)
+            return;
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        r.idle.append(buffer);
+    }
+
+    ThreadBuffer *get()
+    {
+        if (buffer)
+            return buffer;
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        if (!r.idle.isEmpty()) {
+            buffer = r.idle.takeLast();
+        } else {
+            buffer = new ThreadBuffer;
+            buffer->tid = r.buffers.size() + 1;
+            buffer->written.store(0);
+            r.buffers.append(buffer);
+        }
+        buffer->threadName = currentThreadName();
+        if (buffer->threadName.isEmpty())
+            buffer->threadName = QStringLiteral("Worker %1").arg(buffer->tid);
+        return buffer;
+    }
+};
+
+thread_local LocalBuffer localBuffer;
+
+} // namespace
+
+bool Trace::isCompiledIn()
+{
+#ifdef IMAGEVIEWER_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+qint64 Trace::now()
+{
+    return registry().clock.nsecsElapsed();
+}
+
+void Trace::record(const char *name, qint64 startNs, qint64 endNs)
+{
+    ThreadBuffer *buffer = localBuffer.get();
+    const quint64 n = buffer->written.load();
+    Event &event = buffer->events[n & (eventsPerThread - 1)];
+    event.name = name;
+    event.start = startNs;
+    event.duration = endNs - startNs;
+    buffer->written.storeRelease(n + 1);
+}
+
+bool Trace::save(const QString &fileName)
+{
+    QJsonArray events;
+    {
+        Registry &r = registry();
+        QMutexLocker locker(&r.mutex);
+        foreach (ThreadBuffer *buffer, r.buffers) {
+            QJsonObject meta;
+            meta.insert("name", "thread_name");
+            meta.insert("ph", "M");
+            meta.insert("pid", 1);
+            meta.insert("tid", buffer->tid);
+            QJsonObject args;
+            args.insert("name", buffer->threadName);
+            meta.insert("args", args);
+            events.append(meta);
+
+            // The owning thread keeps writing while this copies. Anything
+            // it may have wrapped over in the meantime is dropped.
+            const quint64 end = buffer->written.loadAcquire();
+            const quint64 begin = end > eventsPerThread ? end - eventsPerThread : 0;
+            QVector<Event> copy;
+            copy.reserve(int(end - begin));
+            for (quint64 i = begin; i < end; ++i)
+                copy.append(buffer->events[i & (eventsPerThread - 1)]);
+            const quint64 after = buffer->written.loadAcquire();
+            // The slot of event 'after' may be half written already, and
+            // it is the one event 'after - eventsPerThread' lived in.
+            const quint64 safe = after + 1 > eventsPerThread ? after + 1 - eventsPerThread : 0;
+            for (quint64 i = qMax(begin, safe); i < end; ++i) {
+                const Event &event = copy.at(int(i - begin));
+                QJsonObject span;
+                span.insert("name", QLatin1String(event.name));
+                span.insert("ph", "X");
+                span.insert("pid", 1);
+                span.insert("tid", buffer->tid);
+                span.insert("ts", event.start / 1000.0);
+                span.insert("dur", event.duration / 1000.0);
+                events.append(span);
+            }
+        }
+    }
+
+    QJsonObject trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument(trace).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+
+// Timing spans on the load and display path. Every thread records into its
+// own ring buffer without taking a lock, keeping the most recent spans;
+// save() writes them all as Chrome trace JSON, which chrome://tracing and
+// Perfetto can open.
+//
+// Spans are compiled in only when IMAGEVIEWER_TRACE is defined. Otherwise
+// TRACE_SPAN() expands to nothing.
+class Trace
+{
+public:
+    static bool isCompiledIn();
+    // Nanoseconds on the trace clock.
+    static qint64 now();
+    static void record(const char *name, qint64 startNs, qint64 endNs);
+    static bool save(const QString &fileName);
+};
+
+// Records the lifetime of the enclosing scope. name must be a literal.
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) : m_name(name), m_start(Trace::now()) {}
+    ~TraceSpan() { Trace::record(m_name, m_start, Trace::now()); }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+    const char *m_name;
+    qint64 m_start;
+};
+
+#ifdef IMAGEVIEWER_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#else
+#define TRACE_SPAN(name) do { } while (0)
+#endif
+
+#endif